@@ -0,0 +1,22 @@
+// H → γγ decays, as in the event loop of hist
+
+#include <vector>
+#include <random>
+
+#include "Higgs2diphoton.hh"
+#include "bench.hh"
+
+using ivanp::vec4;
+
+int main() {
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> pt(0,300), eta(-4,4), phi(-3,3);
+  std::vector<vec4> hs;
+  for (int i=0; i<1024; ++i)
+    hs.emplace_back(pt(rng),eta(rng),phi(rng),125.,vec4::PtEtaPhiM);
+
+  Higgs2diphoton decay(1);
+  bench::run("Higgs2diphoton", hs.size(), [&]{
+    for (const auto& h : hs) bench::keep(decay(h));
+  });
+}
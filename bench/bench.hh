@@ -0,0 +1,51 @@
+// ------------------------------------------------------------------
+// Minimal microbenchmark harness for bench/run.py
+//
+// bench::run(name, n, f) calls f() repeatedly for at least BENCH_TIME
+// seconds (environment variable, 0.5 by default), in 5 rounds, and prints
+// the best throughput as a JSON line:
+//   {"name":"vec4/m","per_second":1.2e8}
+// where every call to f() processes n items.
+// ------------------------------------------------------------------
+
+#ifndef IVANP_BENCH_HH
+#define IVANP_BENCH_HH
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace bench {
+
+// Prevents the compiler from optimizing away a computed value
+template <typename T>
+inline void keep(const T& x) noexcept { asm volatile("" : : "g"(&x) : "memory"); }
+
+inline double min_time() {
+  const char* s = std::getenv("BENCH_TIME");
+  return s ? std::atof(s) : 0.5;
+}
+
+template <typename F>
+void run(const char* name, double n, F&& f) {
+  using clock = std::chrono::steady_clock;
+  const double t_round = min_time()/5;
+  double best = 0;
+  for (int round=0; round<5; ++round) {
+    unsigned long calls = 0;
+    const auto t0 = clock::now();
+    double dt;
+    do {
+      for (int i=0; i<16; ++i) f();
+      calls += 16;
+      dt = std::chrono::duration<double>(clock::now()-t0).count();
+    } while (dt < t_round);
+    if (calls*n/dt > best) best = calls*n/dt;
+  }
+  printf("{\"name\":\"%s\",\"per_second\":%.6g}\n",name,best);
+  fflush(stdout);
+}
+
+} // end namespace bench
+
+#endif
@@ -0,0 +1,71 @@
+// Filling of the bin types and histograms of hist
+
+#include <random>
+
+#include "ivanp/string.hh"
+#include "hist_bins.hh"
+#include "bench.hh"
+
+using ivanp::cat;
+
+int main() {
+  // weights of a job with scale and PDF variations
+  const unsigned nw = 40;
+  for (unsigned i=1; i<nw; ++i)
+    multiweight::tags.push_back(cat("w",std::to_string(i)));
+  multiweight::tags.insert(multiweight::tags.begin(),"weight2");
+  weights.assign(nw,1.);
+
+  hist_tags sel;
+  for (unsigned i=0; i<nw; ++i) {
+    sel.weight_pos.push_back(i);
+    sel.weights.push_back(i);
+  }
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> x(0,500);
+  std::vector<double> xs(1024);
+  for (auto& v : xs) v = x(rng);
+  const double n = xs.size();
+
+  // entries in pairs, like RS events
+  auto set_event = [](unsigned i){
+    event_id = i/2;
+    initial_state::set(i%3 ? 21 : 1, 21);
+    photon_cuts::set(i%4);
+  };
+
+  bench::run("bins/basic_bin_t", n, [&]{
+    basic_bin_t bin;
+    for (unsigned i=0; i<xs.size(); ++i) {
+      event_id = i/2;
+      bin += xs[i];
+    }
+    bench::keep(bin);
+  });
+
+  std::vector<tags_t<>> bins(64,tags_t<>(sel));
+  bench::run("bins/tags_t", n, [&]{
+    for (unsigned i=0; i<xs.size(); ++i) {
+      set_event(i);
+      ++bins[i%bins.size()];
+    }
+  });
+
+  const axes_t axes = {{ ivanp::hist::uniform_axis(0,500,50) }};
+  hist_t h(axes,sel);
+  bench::run("bins/hist_fill", n, [&]{
+    for (unsigned i=0; i<xs.size(); ++i) {
+      set_event(i);
+      h(xs[i]);
+    }
+  });
+
+  hist_t hs(axes,sel,true);
+  bench::run("bins/sparse_hist_fill", n, [&]{
+    for (unsigned i=0; i<xs.size(); ++i) {
+      set_event(i);
+      hs(xs[i]);
+    }
+  });
+}
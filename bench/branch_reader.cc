@@ -0,0 +1,49 @@
+// Reading the branches used by hist through branch_reader
+// The ntuple is given as the argument, e.g. one written by gen_ntuple
+
+#include <iostream>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+
+#include "ivanp/branch_reader.hh"
+#include "bench.hh"
+
+using ivanp::branch_reader;
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " ntuple.root\n";
+    return 1;
+  }
+  TFile file(argv[1]);
+  if (file.IsZombie()) return 1;
+  TTree* tree = file.Get<TTree>("t3");
+  if (!tree) return 1;
+
+  TTreeReader reader(tree);
+  branch_reader<int>
+    b_id(reader,"id"),
+    b_nparticle(reader,"nparticle"),
+    b_id1(reader,"id1"),
+    b_id2(reader,"id2");
+  branch_reader<double[],float[]>
+    b_px(reader,"px"),
+    b_py(reader,"py"),
+    b_pz(reader,"pz"),
+    b_E (reader,"E" );
+  branch_reader<int[]> b_kf(reader,"kf");
+  branch_reader<double> b_weight2(reader,"weight2");
+
+  bench::run("branch_reader", tree->GetEntries(), [&]{
+    reader.Restart();
+    double s = 0;
+    while (reader.Next()) {
+      s += *b_weight2 + *b_id + *b_id1 + *b_id2;
+      for (unsigned i=0, n=*b_nparticle; i<n; ++i)
+        s += b_px[i] + b_py[i] + b_pz[i] + b_E[i] + b_kf[i];
+    }
+    bench::keep(s);
+  });
+}
@@ -0,0 +1,32 @@
+// FastJet clustering of the small numbers of partons in the ntuples
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include <fastjet/ClusterSequence.hh>
+
+#include "bench.hh"
+
+int main() {
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> pt(20,300), eta(-4.5,4.5), phi(-3,3);
+  const fastjet::JetDefinition jet_def(fastjet::antikt_algorithm,0.4);
+  fastjet::ClusterSequence::print_banner();
+
+  for (unsigned np : { 2, 3, 4 }) {
+    std::vector<std::vector<fastjet::PseudoJet>> events(256);
+    for (auto& partons : events)
+      for (unsigned i=0; i<np; ++i) {
+        const double pt_ = pt(rng), eta_ = eta(rng), phi_ = phi(rng);
+        partons.emplace_back( pt_*std::cos(phi_), pt_*std::sin(phi_),
+          pt_*std::sinh(eta_), pt_*std::cosh(eta_) );
+      }
+    const std::string name = "fastjet/antikt_" + std::to_string(np);
+    bench::run(name.c_str(), events.size(), [&]{
+      for (const auto& partons : events)
+        bench::keep(
+          fastjet::ClusterSequence(partons,jet_def).inclusive_jets().size());
+    });
+  }
+}
@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+
+import sys, os, json, time, argparse, subprocess
+
+argparser = argparse.ArgumentParser(
+    description='Run the benchmarks and compare them with the baseline',
+    formatter_class=argparse.ArgumentDefaultsHelpFormatter
+)
+argparser.add_argument('-t', '--threshold', type=float, default=0.1,
+    help='fail if throughput is lower than the baseline by this fraction')
+argparser.add_argument('-n', type=int, default=200000,
+    help='number of entries in the generated ntuples')
+argparser.add_argument('-r', type=int, default=1,
+    help='number of runs of the programs, the best is taken')
+argparser.add_argument('-b', type=str, default='bench/baseline.json',
+    help='baseline file')
+argparser.add_argument('--pdf', type=str, default='CT14nlo',
+    help='PDF set for the reweighting benchmarks, if installed')
+argparser.add_argument('--update', action='store_true',
+    help='save the results as the new baseline')
+argparser.add_argument('benchmarks', nargs='*',
+    help='run only the benchmarks with names starting with these')
+args = argparser.parse_args()
+
+# run from the repository's root directory
+os.chdir(os.path.join(os.path.dirname(os.path.abspath(__file__)),'..'))
+work = '.bench'
+os.makedirs(work+'/out', exist_ok=True)
+
+parts = ('B','RS','I','V')
+results = { }
+
+def selected(name):
+    return not args.benchmarks or \
+        any(name.startswith(b) for b in args.benchmarks)
+
+def run(*cmd):
+    subprocess.run(cmd, check=True,
+        stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+
+def timed(*cmd):
+    '''Best wall time of the command in seconds'''
+    best = None
+    for _ in range(args.r):
+        t0 = time.perf_counter()
+        run(*cmd)
+        dt = time.perf_counter() - t0
+        best = dt if best is None else min(best,dt)
+    return best
+
+def have_pdf(name):
+    try:
+        datadir = subprocess.run(('lhapdf-config','--datadir'),
+            check=True, capture_output=True, text=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return False
+    return any(os.path.isdir(os.path.join(d,name))
+        for d in datadir.split(':'))
+
+# fixed local inputs ------------------------------------------------
+for part in parts:
+    f = f'{work}/H1j{part}.root'
+    if not os.path.exists(f):
+        print('generating', f)
+        run('bin/gen_ntuple','-p',part,'-j','1','-n',str(args.n),'-s','1',f)
+
+# microbenchmarks ---------------------------------------------------
+for exe in sorted(os.listdir('bin/bench')):
+    p = subprocess.run(('bin/bench/'+exe, f'{work}/H1jB.root'),
+        check=True, capture_output=True, text=True)
+    for line in p.stdout.splitlines():
+        if not line.startswith('{'): continue
+        r = json.loads(line)
+        if selected(r['name']):
+            results[r['name']] = r['per_second']
+            print(f'{r["name"]:<28}{r["per_second"]:12.4g} /s')
+
+# end to end --------------------------------------------------------
+jets = {
+    'cuts': { 'pt': 30, 'eta': 4.4 },
+    'algorithm': [ 'antikt', 0.4 ]
+}
+
+def hist(name, part, **conf):
+    '''Run hist and return the name of the output file'''
+    out = f'{work}/out/{name}'
+    card = f'{out}.card.json'
+    conf = {
+        'input': { 'files': [ f'{work}/H1j{part}.root' ] },
+        'jets': jets,
+        'binning': 'run/binning.json',
+        'output': out+'.root',
+        **conf
+    }
+    with open(card,'w') as f:
+        json.dump(conf, f, indent=2)
+    output = conf['output']
+    if not isinstance(output,str): output = output['file']
+    best = 0
+    for _ in range(args.r):
+        run('bin/hist',card)
+        # summary written by hist
+        with open(output.removesuffix('.root')+'.json') as f:
+            best = max(best,json.load(f)['entries_per_second'])
+    results['hist/'+name] = best
+    print(f'{"hist/"+name:<28}{best:12.4g} entries/s')
+    return output
+
+outs = [ hist(part,part) for part in parts if selected('hist/'+part) ]
+
+def hbin_hists(name):
+    '''Data blocks of the histograms in a native output file, by name'''
+    with open(name,'rb') as f:
+        f.seek(8)
+        header = json.loads(f.read(int.from_bytes(f.read(8),sys.byteorder)))
+        data = f.read()
+    hists = sorted(header['hists'], key=lambda h: h['offset'])
+    ends = [ h['offset'] for h in hists[1:] ] + [ header['size'] ]
+    return { h['name']: data[8*h['offset']:8*end]
+             for h, end in zip(hists,ends) }
+
+if selected('hist/index'):
+    # skipping entries with too few jets must not change the histograms,
+    # except for the Njets ones, which the skipped entries don't fill
+    conf = { 'jets': { **jets, 'njets_min': 1 } }
+    card = f'{work}/index.card.json'
+    with open(card,'w') as f:
+        json.dump(conf, f)
+    run('bin/make_index','-k','1','-o',f'{work}/index',card,
+        f'{work}/H1jB.root')
+    native = lambda name: { 'output': {
+        'file': f'{work}/out/{name}.hbin', 'format': 'native' } }
+    a = hist('noindex','B', **conf, **native('noindex'))
+    b = hist('index','B', **conf, **native('index'), input={
+        'files': [ f'{work}/H1jB.root' ], 'index': f'{work}/index' })
+    a, b = hbin_hists(a), hbin_hists(b)
+    diff = [ name for name in a.keys() | b.keys()
+             if not name.startswith('Njets_') and a.get(name) != b.get(name) ]
+    if diff:
+        print('with and without the entry index, histograms differ:',
+              *sorted(diff), file=sys.stderr)
+        sys.exit(1)
+
+if selected('merge') and outs:
+    # every output several times, for a run-sized merge
+    ins = outs*4
+    dt = timed('bin/merge','-c','zstd:5',f'{work}/out/merged.root',*ins)
+    results['merge'] = len(ins)/dt
+    print(f'{"merge":<28}{len(ins)/dt:12.4g} files/s')
+
+if have_pdf(args.pdf):
+    rw = { 'reweighting': [{
+        'ren_fac': [ [1,1],[0.5,0.5],[1,0.5],[0.5,1],[2,1],[1,2],[2,2] ],
+        'scale': 'HT1',
+        'pdf': args.pdf,
+        'pdf_var': True
+    }] }
+    for part in ('B','I'):
+        if selected('hist/rw_'+part):
+            out = hist('rw_'+part, part, **rw)
+    if selected('envelopes') and selected('hist/rw_I'):
+        dt = timed('bin/envelopes',out,f'{work}/out/envelopes.root')
+        results['envelopes'] = 1/dt
+        print(f'{"envelopes":<28}{1/dt:12.4g} files/s')
+else:
+    print(f'PDF set {args.pdf} is not installed,'
+          ' skipping reweighting benchmarks')
+
+with open(f'{work}/results.json','w') as f:
+    json.dump(results, f, indent=2, sort_keys=True)
+
+# compare with the baseline -----------------------------------------
+if args.update:
+    baseline = { }
+    if os.path.exists(args.b):
+        with open(args.b) as f:
+            baseline = json.load(f)
+    baseline.update(results)
+    with open(args.b,'w') as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write('\n')
+    print('baseline saved to', args.b)
+    sys.exit(0)
+
+if not os.path.exists(args.b):
+    print(f'no baseline in {args.b}, run make bench-baseline to save one')
+    sys.exit(0)
+with open(args.b) as f:
+    baseline = json.load(f)
+
+failed = [ ]
+print(f'\n{"":<28}{"baseline":>12}{"current":>12}{"change":>9}')
+for name, x in sorted(results.items()):
+    x0 = baseline.get(name)
+    if x0 is None: continue
+    change = x/x0 - 1
+    bad = change < -args.threshold
+    if bad: failed.append(name)
+    print(f'{name:<28}{x0:12.4g}{x:12.4g}{change:+9.1%}'
+          + (' REGRESSION' if bad else ''))
+
+if failed:
+    print(f'\n{len(failed)} regressions beyond {args.threshold:.0%}:',
+          ', '.join(failed))
+    sys.exit(1)
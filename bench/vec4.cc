@@ -0,0 +1,44 @@
+// Kinematics of ivanp::vec4, as used in the event loop of hist
+
+#include <vector>
+#include <random>
+
+#include "ivanp/vec4.hh"
+#include "bench.hh"
+
+using ivanp::vec4;
+
+int main() {
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> pt(20,500), eta(-4.5,4.5), phi(-3,3);
+  std::vector<vec4> ps;
+  for (int i=0; i<1024; ++i)
+    ps.emplace_back(pt(rng),eta(rng),phi(rng),0.,vec4::PtEtaPhiM);
+  const double n = ps.size();
+
+  bench::run("vec4/pt", n, [&]{
+    double s = 0;
+    for (const auto& p : ps) s += p.pt();
+    bench::keep(s);
+  });
+  bench::run("vec4/eta", n, [&]{
+    double s = 0;
+    for (const auto& p : ps) s += p.eta();
+    bench::keep(s);
+  });
+  bench::run("vec4/rap", n, [&]{
+    double s = 0;
+    for (const auto& p : ps) s += p.rap();
+    bench::keep(s);
+  });
+  bench::run("vec4/sum_m", n-1, [&]{
+    double s = 0;
+    for (size_t i=1; i<ps.size(); ++i) s += (ps[i-1]+ps[i]).m();
+    bench::keep(s);
+  });
+  bench::run("vec4/deltaR", n-1, [&]{
+    double s = 0;
+    for (size_t i=1; i<ps.size(); ++i) s += deltaR(ps[i-1],ps[i]);
+    bench::keep(s);
+  });
+}
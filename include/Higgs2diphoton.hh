@@ -3,6 +3,7 @@
 
 #include <array>
 #include <random>
+#include <string>
 
 #include "ivanp/vec4.hh"
 
@@ -21,6 +22,13 @@ public:
   using photons_type = std::array<vec_t,2>;
 
   photons_type operator()(const vec_t& Higgs, bool new_kin=true);
+
+  // draw new decay kinematics without a Higgs boson, for skipped entries
+  void draw();
+
+  // state of the random number generator, for checkpoints
+  std::string state() const;
+  void state(const std::string& s);
 };
 
 
@@ -0,0 +1,171 @@
+// ------------------------------------------------------------------
+// Entry index: per-entry selection bitmaps of an ntuple, written by
+// make_index, and used by hist to skip entries, reading only their id
+// and ncount
+//
+// File structure:
+//   8 bytes   magic "NTINDEX" + version
+//   8 bytes   header length in bytes
+//   header    JSON text, padded with spaces to align the data to 8 bytes
+//   data      64-bit words of the bitmaps in native byte order
+//
+// The header contains:
+//   "tree":    name of the indexed TTree
+//   "entries": number of entries in the tree
+//   "jets":    jet definition and cuts, and their "key"
+//   "njets":   array of k, with the bitmap of entries with at least k jets
+//              for each, of ceil(entries/64) words, in the same order
+//   "size":    total number of words in the data section
+//
+// An index is a prefilter: the selection is still applied by hist.
+// Skipped entries don't fill the Njets histograms.
+// ------------------------------------------------------------------
+
+#ifndef IVANP_ENTRY_INDEX_HH
+#define IVANP_ENTRY_INDEX_HH
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <nlohmann/json.hpp>
+
+#include "ivanp/string.hh"
+#include "ivanp/hash.hh"
+
+namespace entry_index {
+
+constexpr char magic[8] = { 'N','T','I','N','D','E','X', 1 };
+
+struct error: std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// Identifies a jet definition and cuts in the names of index files
+inline std::string jets_key(
+  const std::string& description, double pt_cut, double eta_cut
+) {
+  ivanp::hasher h;
+  h.add(nlohmann::json{ description, pt_cut, eta_cut }.dump());
+  return h.str().substr(0,8);
+}
+
+// Index of the ntuple, in dir, or next to the ntuple if dir is empty:
+// dir/ntuple.key.idx, without the ntuple's .root extension
+inline std::string path(
+  std::string_view ntuple, std::string_view dir, std::string_view key
+) {
+  if (ntuple.ends_with(".root")) ntuple.remove_suffix(5);
+  if (!dir.empty()) {
+    const auto slash = ntuple.rfind('/');
+    if (slash != ntuple.npos) ntuple.remove_prefix(slash+1);
+  }
+  return ivanp::cat(dir, dir.empty() || dir.ends_with('/') ? "" : "/",
+    ntuple, '.', key, ".idx");
+}
+
+inline bool test(const uint64_t* bits, uint64_t i) noexcept {
+  return (bits[i >> 6] >> (i & 63)) & 1;
+}
+inline void set(uint64_t* bits, uint64_t i) noexcept {
+  bits[i >> 6] |= uint64_t(1) << (i & 63);
+}
+
+// Read-only memory-mapped file
+class file {
+  void* addr = MAP_FAILED;
+  size_t len = 0;
+  nlohmann::json _header;
+  const uint64_t* _data = nullptr;
+  size_t _size = 0;
+
+public:
+  file(const char* name) {
+    const int fd = ::open(name,O_RDONLY);
+    if (fd < 0) throw error(ivanp::cat("cannot open ",name));
+    struct stat st;
+    if (::fstat(fd,&st)) {
+      ::close(fd);
+      throw error(ivanp::cat("cannot stat ",name));
+    }
+    len = st.st_size;
+    if (len >= 16)
+      addr = ::mmap(nullptr,len,PROT_READ,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if (addr == MAP_FAILED) throw error(ivanp::cat("cannot map ",name));
+
+    try { // the destructor is not called if the constructor throws
+      const char* p = static_cast<const char*>(addr);
+      if (memcmp(p,magic,sizeof(magic)))
+        throw error(ivanp::cat(name," is not an entry index file"));
+      uint64_t hlen;
+      memcpy(&hlen,p+8,8);
+      if (16+hlen > len) throw error(ivanp::cat(name," is truncated"));
+      _header = nlohmann::json::parse(std::string_view(p+16,hlen));
+      _size = _header.at("size");
+      _data = reinterpret_cast<const uint64_t*>(p+16+hlen);
+      if (16+hlen+_size*8 > len)
+        throw error(ivanp::cat(name," is truncated"));
+    } catch (...) {
+      ::munmap(addr,len);
+      throw;
+    }
+  }
+  ~file() { if (addr != MAP_FAILED) ::munmap(addr,len); }
+  file(const file&) = delete;
+  file& operator=(const file&) = delete;
+
+  const nlohmann::json& header() const noexcept { return _header; }
+  uint64_t entries() const { return _header.at("entries"); }
+
+  // Bitmap of entries with at least k jets, for the largest indexed k
+  // not above njets, or nullptr if there is none
+  const uint64_t* bitmap(unsigned njets) const {
+    const uint64_t words = (entries()+63)/64;
+    const uint64_t* bits = nullptr;
+    unsigned best = 0, i = 0;
+    for (unsigned k : _header.at("njets")) {
+      if (best < k && k <= njets) {
+        best = k;
+        bits = _data + i*words;
+      }
+      ++i;
+    }
+    return bits;
+  }
+};
+
+// Written to a temporary file first, and renamed when complete
+inline void write(
+  const std::string& name, const nlohmann::json& header,
+  const uint64_t* data, size_t n
+) {
+  std::string h = header.dump();
+  h.resize(((16+h.size()+7)/8)*8-16,' ');
+  const uint64_t hlen = h.size();
+
+  const std::string tmp = name + ".tmp";
+  { std::ofstream f;
+    f.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    f.open(tmp,std::ios::binary);
+    f.write(magic,sizeof(magic));
+    f.write(reinterpret_cast<const char*>(&hlen),8);
+    f.write(h.data(),h.size());
+    f.write(reinterpret_cast<const char*>(data),n*8);
+  }
+  if (std::rename(tmp.c_str(),name.c_str()))
+    throw error(ivanp::cat("cannot rename ",tmp," to ",name));
+}
+
+} // end namespace entry_index
+
+#endif
@@ -0,0 +1,390 @@
+// ------------------------------------------------------------------
+// Envelope kernels operating on contiguous arrays of bin values
+// - scale_envelope: min/max over scale variations
+// - pdf_envelope: PDF uncertainty of every bin, following
+//   LHAPDF::PDFSet::uncertainty, computed for all bins at once
+// - column_envelopes: which envelopes to compute from columns of bins
+//   labeled by weight names, shared by envelopes, merge, and hist
+// - compact_envelopes: column_envelopes of a compact layout TH2
+// ------------------------------------------------------------------
+
+#ifndef ENVELOPES_HH
+#define ENVELOPES_HH
+
+#include <iostream>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <regex>
+#include <optional>
+#include <stdexcept>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+
+#include <TH2.h>
+
+#include <LHAPDF/LHAPDF.h>
+
+#include "ivanp/string.hh"
+
+namespace envelopes {
+
+// Bins of a histogram of doubles
+inline double* bins(TH1* h) {
+  auto* a = dynamic_cast<TArrayD*>(h);
+  if (!a) throw std::runtime_error(ivanp::cat(
+    h->GetName()," is a ",h->ClassName(),
+    ", envelopes are only computed for histograms of doubles"));
+  return a->GetArray();
+}
+
+// u and d must be initialized with the nominal values
+inline void scale_envelope(
+  const std::vector<const double*>& vars,
+  double* __restrict u, double* __restrict d, size_t n
+) noexcept {
+  for (const double* __restrict x : vars)
+    for (size_t i=0; i<n; ++i) {
+      if (x[i] > u[i]) u[i] = x[i];
+      if (x[i] < d[i]) d[i] = x[i];
+    }
+}
+
+class pdf_envelope {
+  const LHAPDF::PDFSet* set;
+  enum { replicas, symmhessian, hessian, other } type = other;
+  double scale = 1;
+
+  // errplus and errminus before rescaling to the requested CL,
+  // summing over members in the same order as LHAPDF
+  void unscaled(
+    const std::vector<const double*>& vars,
+    double* __restrict ep, double* __restrict em, size_t n
+  ) const {
+    const double* __restrict x0 = vars[0];
+    const size_t nmem = vars.size()-1;
+    std::fill(ep,ep+n,0.);
+    std::fill(em,em+n,0.);
+    if (type == replicas) { // ep: average, em: squares
+      for (size_t m=1; m<=nmem; ++m) {
+        const double* __restrict x = vars[m];
+        for (size_t i=0; i<n; ++i) {
+          ep[i] += x[i];
+          em[i] += x[i]*x[i];
+        }
+      }
+      for (size_t i=0; i<n; ++i) {
+        double av = ep[i], sd = em[i];
+        av /= nmem;
+        sd /= nmem;
+        sd = nmem/(nmem-1.0)*(sd-av*av);
+        ep[i] = em[i] = (sd > 0.0 && nmem > 1) ? std::sqrt(sd) : 0.0;
+      }
+    } else if (type == symmhessian) {
+      for (size_t m=1; m<=nmem; ++m) {
+        const double* __restrict x = vars[m];
+        for (size_t i=0; i<n; ++i) {
+          const double dx = x[i]-x0[i];
+          ep[i] += dx*dx;
+        }
+      }
+      for (size_t i=0; i<n; ++i)
+        ep[i] = em[i] = std::sqrt(ep[i]);
+    } else { // hessian
+      for (size_t m=1; m<nmem; m+=2) {
+        const double* __restrict a = vars[m];
+        const double* __restrict b = vars[m+1];
+        for (size_t i=0; i<n; ++i) {
+          const double p = std::max(std::max(a[i]-x0[i],b[i]-x0[i]),0.0);
+          const double q = std::max(std::max(x0[i]-a[i],x0[i]-b[i]),0.0);
+          ep[i] += p*p;
+          em[i] += q*q;
+        }
+      }
+      for (size_t i=0; i<n; ++i) {
+        ep[i] = std::sqrt(ep[i]);
+        em[i] = std::sqrt(em[i]);
+      }
+    }
+  }
+
+public:
+  // The closed-form formulas are only used if they reproduce LHAPDF
+  // exactly on a test vector. Otherwise, e.g. for sets with parameter
+  // variations, LHAPDF is called for every bin.
+  pdf_envelope(const LHAPDF::PDFSet* set): set(set) {
+    const std::string t = set->errorType();
+    if (t == "replicas") type = replicas;
+    else if (t == "symmhessian") type = symmhessian;
+    else if (t == "hessian") type = hessian;
+    else return;
+
+    const size_t nvars = set->size();
+    std::vector<double> values(nvars);
+    for (size_t m=0; m<nvars; ++m) // arbitrary, asymmetric values
+      values[m] = 1 + 0.01*((m*7919)%13) - 0.005*(m%3);
+    LHAPDF::PDFUncertainty unc;
+    set->uncertainty(unc,values);
+    scale = unc.scale;
+
+    std::vector<const double*> vars(nvars);
+    for (size_t m=0; m<nvars; ++m) vars[m] = &values[m];
+    double ep, em;
+    unscaled(vars,&ep,&em,1);
+    if (!(ep*scale == unc.errplus && em*scale == unc.errminus))
+      type = other;
+  }
+
+  // number of members of the set, including the nominal
+  size_t size() const { return set->size(); }
+  void check_size(size_t nvars) const {
+    if (nvars != size()) throw std::runtime_error(ivanp::cat(
+      "PDF set ",set->name()," has ",std::to_string(size()),
+      " members, but ",std::to_string(nvars),
+      " were given, including the nominal"));
+  }
+
+  // u = nominal + errplus, d = nominal - errminus
+  // vars[0] is the nominal, followed by all members of the set
+  void operator()(
+    const std::vector<const double*>& vars,
+    double* __restrict u, double* __restrict d, size_t n
+  ) const {
+    check_size(vars.size());
+    const double* __restrict x0 = vars[0];
+    if (type == other) {
+      static std::mutex mx; // LHAPDF is not guaranteed to be thread-safe
+      std::lock_guard lock(mx);
+      std::vector<double> values(vars.size());
+      LHAPDF::PDFUncertainty unc;
+      for (size_t i=0; i<n; ++i) {
+        for (size_t m=0; m<vars.size(); ++m)
+          values[m] = vars[m][i];
+        set->uncertainty(unc,values);
+        u[i] = x0[i]+unc.errplus;
+        d[i] = x0[i]-unc.errminus;
+      }
+    } else {
+      unscaled(vars,u,d,n);
+      for (size_t i=0; i<n; ++i) {
+        const double ep = u[i]*scale, em = d[i]*scale;
+        u[i] = x0[i]+ep;
+        d[i] = x0[i]-em;
+      }
+    }
+  }
+};
+
+inline const LHAPDF::PDFSet* get_pdf_set(const std::string& name) {
+  static std::unordered_map<std::string,LHAPDF::PDFSet> sets;
+  return &sets.try_emplace(name,name).first->second;
+}
+inline const pdf_envelope* get_pdf_envelope(const std::string& name) {
+  static std::unordered_map<std::string,pdf_envelope> envs;
+  auto it = envs.find(name);
+  if (it == envs.end()) {
+    const auto* pdf_set = get_pdf_set(name);
+    std::cout << pdf_set->description() << std::endl;
+    it = envs.try_emplace(name,pdf_set).first;
+  }
+  return &it->second;
+}
+
+// Weight names of the form "prefix PDFSET:member ren:x fac:y [suffix]"
+struct weight_label {
+  std::array<std::string,3> lbl; // prefix, PDF set, suffix
+  int pdf;
+  double ren, fac;
+  bool nom_pdf() const noexcept { return pdf == 0; }
+  bool nom_scale() const noexcept { return ren == 1 && fac == 1; }
+  // name of the nominal weight without the variation numbers
+  std::string name() const {
+    return ivanp::cat(lbl[0],lbl[1]," "+!lbl[2].size(),lbl[2]);
+  }
+};
+inline std::optional<weight_label> parse_weight(const std::string& name) {
+  static const std::regex r(
+    R"((.*\s)([^\s]+):(\d+) ren:([\d.]+) fac:([\d.]+)(?:\s+(.*))?)");
+  std::smatch m;
+  if (!std::regex_match(name,m,r)) return std::nullopt;
+  return weight_label {
+    { m.str(1), m.str(2), m.str(6) },
+    std::stoi(m[3]), std::stod(m[4]), std::stod(m[5])
+  };
+}
+
+// Envelopes of columns of bins, labeled as "weight/tag1/tag2".
+// Columns of weights which aren't variations are copied.
+// Variations of the same weight and tags are replaced with columns
+// labeled "name/tags", "name scale_up/tags", "name scale_down/tags",
+// "name pdf_up/tags", "name pdf_down/tags", the same as envelopes
+// directories, unless keep_vars is true.
+// Envelope columns have no statistical uncertainties; source() tells
+// which output columns are copies, whose sums of squares can be copied too.
+class column_envelopes {
+  struct group {
+    int nom = -1;
+    std::map<std::array<double,2>,int> scale;
+    std::map<int,int> pdf;
+    const pdf_envelope* pdf_env = nullptr;
+    int scale_out = -1, pdf_out = -1;
+  };
+  std::vector<std::string> _labels;
+  std::vector<int> _source; // input column of copied output columns
+  std::vector<group> groups;
+
+public:
+  column_envelopes(const std::vector<std::string>& labels, bool keep_vars) {
+    std::vector<int> other; // columns copied unchanged
+    std::map<std::array<std::string,4>,group> variations;
+    for (int j=0, n=labels.size(); j<n; ++j) {
+      const std::string& label = labels[j];
+      const auto slash = label.find('/');
+      const auto wl = parse_weight(label.substr(0,slash));
+      if (!wl) {
+        other.push_back(j);
+        continue;
+      }
+      auto& v = variations[{ wl->lbl[0], wl->lbl[1], wl->lbl[2],
+        slash==label.npos ? std::string() : label.substr(slash) }];
+      bool duplicate;
+      if (wl->nom_pdf() && wl->nom_scale()) {
+        duplicate = v.nom >= 0;
+        v.nom = j;
+      } else if (wl->nom_pdf()) {
+        duplicate = !v.scale.try_emplace({wl->ren,wl->fac},j).second;
+        if (keep_vars) other.push_back(j);
+      } else if (wl->nom_scale()) {
+        duplicate = !v.pdf.try_emplace(wl->pdf,j).second;
+        if (keep_vars) other.push_back(j);
+      } else {
+        std::cerr << "unexpected variation " << label << std::endl;
+        continue;
+      }
+      if (duplicate) throw std::runtime_error(ivanp::cat(
+        "duplicate ",label));
+    }
+
+    for (int j : other) {
+      _labels.push_back(labels[j]);
+      _source.push_back(j);
+    }
+    for (auto& [lbl,v] : variations) {
+      const auto name = weight_label{{lbl[0],lbl[1],lbl[2]}}.name();
+      if (v.nom < 0) throw std::runtime_error(ivanp::cat(
+        "no nominal weight for ",name,lbl[3]));
+      _labels.push_back(name+lbl[3]);
+      _source.push_back(v.nom);
+      if (!v.scale.empty()) {
+        v.scale_out = _labels.size();
+        _labels.push_back(name+" scale_up"+lbl[3]);
+        _labels.push_back(name+" scale_down"+lbl[3]);
+        _source.resize(_labels.size(),-1);
+      }
+      if (!v.pdf.empty()) {
+        v.pdf_env = get_pdf_envelope(lbl[1]);
+        v.pdf_env->check_size(v.pdf.size()+1);
+        v.pdf_out = _labels.size();
+        _labels.push_back(name+" pdf_up"+lbl[3]);
+        _labels.push_back(name+" pdf_down"+lbl[3]);
+        _source.resize(_labels.size(),-1);
+      }
+      groups.push_back(std::move(v));
+    }
+  }
+
+  // labels of the output columns
+  const std::vector<std::string>& labels() const noexcept { return _labels; }
+  // input column copied to an output column, or -1 for envelopes
+  int source(unsigned k) const noexcept { return _source[k]; }
+
+  // in[j] and out[k] point to columns of n bins
+  void operator()(
+    const double* const* in, double* const* out, size_t n
+  ) const {
+    for (unsigned k=0; k<_source.size(); ++k)
+      if (const int j = _source[k]; j >= 0 && in[j] != out[k])
+        std::copy(in[j], in[j]+n, out[k]);
+    for (const auto& v : groups) {
+      const double* nom = in[v.nom];
+      if (v.scale_out >= 0) {
+        double* u = out[v.scale_out];
+        double* d = out[v.scale_out+1];
+        std::copy(nom, nom+n, u);
+        std::copy(nom, nom+n, d);
+        std::vector<const double*> xs;
+        for (const auto& [kk,j] : v.scale) xs.push_back(in[j]);
+        scale_envelope(xs,u,d,n);
+      }
+      if (v.pdf_out >= 0) {
+        std::vector<const double*> xs { nom };
+        for (const auto& [m,j] : v.pdf) xs.push_back(in[j]);
+        (*v.pdf_env)(xs,out[v.pdf_out],out[v.pdf_out+1],n);
+      }
+    }
+  }
+};
+
+// TH2D with the same x axis as h, and a labeled y bin for every column
+inline TH2D* make_compact(
+  const TH2* h, const std::vector<std::string>& labels
+) {
+  const TAxis* xa = h->GetXaxis();
+  const int nx = xa->GetNbins(), ny = labels.size();
+  const auto* edges = xa->GetXbins();
+  TH2D* out = (edges && edges->GetSize())
+    ? new TH2D(h->GetName(),"",nx,edges->GetArray(),ny,0,ny)
+    : new TH2D(h->GetName(),"",nx,xa->GetXmin(),xa->GetXmax(),ny,0,ny);
+  TAxis* ya = out->GetYaxis();
+  for (int j=0; j<ny; ++j)
+    ya->SetBinLabel(j+1,labels[j].c_str());
+  out->Sumw2(true);
+  return out;
+}
+
+// Labels of the y bins of a compact layout TH2, one per column
+inline std::vector<std::string> column_labels(const TH2* h) {
+  const TAxis* ya = h->GetYaxis();
+  std::vector<std::string> labels;
+  for (int j=0, ny=ya->GetNbins(); j<ny; ++j)
+    labels.emplace_back(ya->GetBinLabel(j+1));
+  return labels;
+}
+
+// New TH2D with the columns of h replaced as set by plan, made from the
+// column_labels of h. The envelopes are computed by the function passed
+// to run, which only accesses arrays of bins, so that run may defer it
+// to another thread.
+template <typename Run>
+TH2D* compact_envelopes(TH2* h, const column_envelopes& plan, Run&& run) {
+  const int ny = h->GetYaxis()->GetNbins(), nx2 = h->GetNbinsX()+2;
+  const double* w  = bins(h);
+  const double* w2 = h->GetSumw2()->GetArray();
+
+  TH2D* out = make_compact(h,plan.labels());
+  double* ow  = bins(out);
+  double* ow2 = out->GetSumw2()->GetArray();
+  std::vector<const double*> in(ny);
+  for (int j=0; j<ny; ++j) in[j] = w + (j+1)*nx2;
+  std::vector<double*> cols(plan.labels().size());
+  for (unsigned k=0; k<cols.size(); ++k) {
+    cols[k] = ow + (k+1)*nx2;
+    // stat. unc. only for copied columns
+    if (const int j = plan.source(k); j >= 0)
+      std::copy(w2+(j+1)*nx2, w2+(j+2)*nx2, ow2+(k+1)*nx2);
+  }
+  run([&plan,in=std::move(in),cols=std::move(cols),nx2]{
+    plan(in.data(),cols.data(),nx2);
+  });
+  return out;
+}
+inline TH2D* compact_envelopes(TH2* h, const column_envelopes& plan) {
+  return compact_envelopes(h,plan,[](auto&& f){ f(); });
+}
+
+} // end namespace envelopes
+
+#endif
@@ -0,0 +1,131 @@
+// ------------------------------------------------------------------
+// Native binary histograms format
+//
+// File structure:
+//   8 bytes   magic "NTHIST\0" + version
+//   8 bytes   header length in bytes
+//   header    JSON text, padded with spaces to align the data to 64 bytes
+//   data      doubles in native byte order
+//
+// The header contains:
+//   "tags":  tags tree string, same as the "tags" TNamed in ROOT output
+//   "N":     { "offset", "labels" } of the normalization counters
+//   "hists": array of 1D histogram slices, each with
+//            "name", "axis", "labels" (one per weight and tags combination),
+//            and "offset" of the data block in doubles.
+//            The data block holds sum of weights for every label,
+//            followed by sum of squared weights for every label,
+//            each as a contiguous row of nbins values,
+//            including underflow and overflow.
+//   "size":  total number of doubles in the data section
+// ------------------------------------------------------------------
+
+#ifndef IVANP_HBIN_HH
+#define IVANP_HBIN_HH
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+#include "ivanp/string.hh"
+
+namespace hbin {
+
+inline constexpr char magic[8] = { 'N','T','H','I','S','T','\0','\1' };
+inline constexpr size_t align = 64;
+
+struct error: std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// Read-only memory-mapped file
+class file {
+  void* addr = MAP_FAILED;
+  size_t len = 0;
+  std::string_view _header_str;
+  nlohmann::json _header;
+  const double* _data = nullptr;
+  size_t _size = 0;
+
+public:
+  file(const char* name) {
+    const int fd = ::open(name,O_RDONLY);
+    if (fd < 0) throw error(ivanp::cat("cannot open ",name));
+    struct stat st;
+    if (::fstat(fd,&st)) {
+      ::close(fd);
+      throw error(ivanp::cat("cannot stat ",name));
+    }
+    len = st.st_size;
+    if (len >= 16)
+      addr = ::mmap(nullptr,len,PROT_READ,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if (addr == MAP_FAILED) throw error(ivanp::cat("cannot map ",name));
+    ::madvise(addr,len,MADV_SEQUENTIAL);
+
+    try { // the destructor is not called if the constructor throws
+      const char* p = static_cast<const char*>(addr);
+      if (memcmp(p,magic,sizeof(magic)))
+        throw error(ivanp::cat(name," is not an hbin file"));
+      uint64_t hlen;
+      memcpy(&hlen,p+8,8);
+      if (16+hlen > len) throw error(ivanp::cat(name," is truncated"));
+      _header_str = { p+16, hlen };
+      _header = nlohmann::json::parse(_header_str);
+      _size = _header.at("size");
+      _data = reinterpret_cast<const double*>(p+16+hlen);
+      if (16+hlen+_size*sizeof(double) > len)
+        throw error(ivanp::cat(name," is truncated"));
+    } catch (...) {
+      ::munmap(addr,len);
+      throw;
+    }
+  }
+  ~file() { if (addr != MAP_FAILED) ::munmap(addr,len); }
+  file(const file&) = delete;
+  file& operator=(const file&) = delete;
+
+  std::string_view header_str() const noexcept { return _header_str; }
+  const nlohmann::json& header() const noexcept { return _header; }
+  const double* data() const noexcept { return _data; }
+  size_t size() const noexcept { return _size; }
+};
+
+inline void write(
+  const char* name, const nlohmann::json& header,
+  const double* data, size_t n
+) {
+  std::string h = header.dump();
+  h.resize(((16+h.size()+align-1)/align)*align-16,' ');
+  const uint64_t hlen = h.size();
+
+  std::ofstream f;
+  f.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+  f.open(name,std::ios::binary);
+  f.write(magic,sizeof(magic));
+  f.write(reinterpret_cast<const char*>(&hlen),8);
+  f.write(h.data(),h.size());
+  f.write(reinterpret_cast<const char*>(data),n*sizeof(double));
+}
+
+// out += in; written to be auto-vectorized
+inline void add(
+  double* __restrict out, const double* __restrict in, size_t n
+) noexcept {
+  for (size_t i=0; i<n; ++i)
+    out[i] += in[i];
+}
+
+} // end namespace hbin
+
+#endif
@@ -0,0 +1,331 @@
+// ------------------------------------------------------------------
+// Bins and histograms filled by hist: every bin carries a tree of tags,
+// multiple weights, initial state, and photon cuts, with basic bins
+// handling NLO MC multiple entries per event at the leaves.
+// ------------------------------------------------------------------
+
+#ifndef HIST_BINS_HH
+#define HIST_BINS_HH
+
+#include <vector>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+
+#include "ivanp/hist/histograms.hh"
+#include "ivanp/fast_axes.hh"
+
+// Global event variables
+inline std::vector<double> weights; // multiple weights per event
+inline int event_id = -1;
+
+struct hist_tags { // weights and tags carried by a histogram
+  std::vector<unsigned> weights; // indices of carried weights
+  std::vector<int> weight_pos; // position of each weight in bins, or -1
+  bool initial_state = true, photon_cuts = true;
+};
+
+struct initial_state {
+  static constexpr const char* name = "initial_state";
+  static constexpr std::array<const char*,4> tags {
+    "all", "gg", "gq", "qq"
+  };
+  inline static unsigned index;
+  static void set(int id1, int id2) noexcept {
+    const bool g1 = (id1 == 21), g2 = (id2 == 21);
+    index = ( g1!=g2 ? 2 : ( g1 ? 1 : 3 ) );
+  }
+};
+template <typename Bin, bool Split = true>
+struct initial_state_tag: initial_state {
+  // only "all" if not split by initial state
+  std::array<Bin,(Split ? tags.size() : 1)> bins;
+
+  void operator+=(double w) noexcept {
+    bins[0] += w;
+    if constexpr (Split) bins[index] += w;
+  }
+  void finalize() noexcept {
+    for (auto& bin : bins)
+      bin.finalize();
+  }
+  const Bin& operator[](size_t i) const noexcept { return bins[i]; }
+  const Bin* find(size_t i) const noexcept {
+    return i < bins.size() ? &bins[i] : nullptr;
+  }
+};
+
+struct photon_cuts {
+  static constexpr const char* name = "photon_cuts";
+  static constexpr std::array<const char*,2> tags {
+    "all", "photons_pass"
+  };
+  inline static bool pass;
+  static void set(bool _pass) noexcept {
+    pass = _pass;
+  }
+};
+template <typename Bin, bool Split = true>
+struct photon_cuts_tag: photon_cuts {
+  // only "all" if not split by photon cuts
+  std::array<Bin,(Split ? tags.size() : 1)> bins;
+
+  void operator+=(double w) noexcept {
+    bins[0] += w;
+    if constexpr (Split) if (pass) bins[1] += w;
+  }
+  void finalize() noexcept {
+    for (auto& bin : bins)
+      bin.finalize();
+  }
+  const Bin& operator[](size_t i) const noexcept { return bins[i]; }
+  const Bin* find(size_t i) const noexcept {
+    return i < bins.size() ? &bins[i] : nullptr;
+  }
+};
+
+struct multiweight {
+  static constexpr const char* name = "weight";
+  inline static std::vector<std::string> tags;
+};
+template <typename Bin>
+struct multiweight_tag: multiweight { // handle multiple weights
+  const hist_tags* sel = nullptr;
+  std::vector<Bin> bins; // only for the selected weights
+
+  multiweight_tag() noexcept = default;
+  explicit multiweight_tag(const hist_tags& sel)
+  : sel(&sel), bins(sel.weights.size()) { }
+  void operator++() noexcept {
+    for (size_t i = bins.size(); i--; )
+      bins[i] += weights[sel->weights[i]];
+  }
+  void finalize() noexcept {
+    for (auto& bin : bins)
+      bin.finalize();
+  }
+  const Bin& operator[](size_t i) const noexcept { return bins[i]; }
+  const Bin* find(size_t i) const noexcept {
+    const int j = sel->weight_pos[i];
+    return j < 0 ? nullptr : &bins[j];
+  }
+};
+
+struct basic_bin_t { // handle NLO MC multiple entries per event
+  double w=0, w2=0, sumw=0;
+  int prev_id = -1;
+  void operator+=(double weight) noexcept {
+    if (prev_id != event_id) {
+      w += sumw;
+      w2 += sumw*sumw;
+      sumw = weight;
+      prev_id = event_id;
+    } else {
+      sumw += weight;
+    }
+  }
+  void finalize() noexcept {
+    w += sumw;
+    w2 += sumw*sumw;
+    sumw = 0;
+    prev_id = -1;
+  }
+};
+
+template <typename Bin>
+struct dense_bin: Bin { // stored inline in dense histograms
+  using cell_type = Bin;
+  using Bin::Bin;
+
+  Bin& get() noexcept { return *this; }
+  const Bin* get_if() const noexcept { return this; }
+};
+
+using axis_t = ivanp::hist::variant_axis<
+  ivanp::hist::uniform_axis<>,
+  ivanp::hist::cont_axis<>,
+  ivanp::hist::log_uniform_axis<>,
+  ivanp::hist::lut_axis<> >;
+using axes_t = std::vector<std::vector< axis_t >>;
+
+// Histogram storing only its filled bins, in a hash map keyed by the flat
+// bin index. The bins are numbered in the same order as in the dense
+// histograms with perbin_axes: the last dimension is the fastest, and every
+// row of a dimension uses the next of its axes, with the last one repeated.
+template <typename Bin>
+class sparse_hist {
+  const axes_t* _axes;
+  const hist_tags* _sel;
+  std::unordered_map<size_t,Bin> _bins;
+  // for every dimension, first bin of the rows of each axis
+  std::vector<std::vector<size_t>> _starts;
+  size_t _size = 1;
+
+  // first bin of row r of dimension d, among the bins of dimensions 0 ... d
+  size_t start(unsigned d, size_t r) const noexcept {
+    const auto& s = _starts[d];
+    const size_t last = s.size()-2;
+    return r <= last ? s[r] : s[last] + (r-last)*(s[last+1]-s[last]);
+  }
+
+public:
+  template <typename H> // cell of a sparse_hist or a const sparse_hist
+  class cell {
+    H* h;
+    size_t i;
+  public:
+    using cell_type = Bin;
+    cell(H* h, size_t i) noexcept: h(h), i(i) { }
+
+    Bin& get() requires (!std::is_const_v<H>) { // allocate if needed
+      return h->_bins.try_emplace(i,*h->_sel).first->second;
+    }
+    const Bin* get_if() const {
+      const auto it = h->_bins.find(i);
+      return it == h->_bins.end() ? nullptr : &it->second;
+    }
+  };
+
+  template <typename H>
+  class iterator {
+    H* h;
+    size_t i;
+  public:
+    iterator(H* h, size_t i) noexcept: h(h), i(i) { }
+    cell<H> operator*() const noexcept { return { h, i }; }
+    iterator& operator++() noexcept { ++i; return *this; }
+    iterator operator++(int) noexcept { return { h, i++ }; }
+    bool operator==(const iterator&) const noexcept = default;
+  };
+
+  sparse_hist(const axes_t& axes, const hist_tags& sel)
+  : _axes(&axes), _sel(&sel), _starts(axes.size()) {
+    for (unsigned d=0; d<axes.size(); ++d) {
+      auto& s = _starts[d];
+      s.reserve(axes[d].size()+1);
+      s.push_back(0);
+      for (const auto& axis : axes[d])
+        s.push_back(s.back() + axis.nbins());
+      _size = start(d,_size);
+    }
+  }
+
+  template <typename... X>
+  void operator()(const X&... x) {
+    size_t i = 0;
+    unsigned d = 0;
+    auto next = [&](double v){ // index among the bins of dimensions 0 ... d
+      const auto& axes = (*_axes)[d];
+      const auto& axis = axes[std::min<size_t>(i,axes.size()-1)];
+      i = start(d++,i) + std::visit([v](const auto& ax) -> size_t {
+        return ax.find_bin(v);
+      },*axis);
+    };
+    (next(x),...);
+    ++_bins.try_emplace(i,*_sel).first->second;
+  }
+  void finalize() {
+    for (auto& [i,bin] : _bins)
+      bin.finalize();
+  }
+
+  const axes_t& axes() const noexcept { return *_axes; }
+  size_t size() const noexcept { return _size; }
+
+  // all the bins, including those that are not filled
+  iterator<sparse_hist> begin() noexcept { return { this, 0 }; }
+  iterator<sparse_hist> end() noexcept { return { this, _size }; }
+  iterator<const sparse_hist> begin() const noexcept { return { this, 0 }; }
+  iterator<const sparse_hist> end() const noexcept { return { this, _size }; }
+  const sparse_hist& bins() const noexcept { return *this; }
+};
+
+template <typename>
+constexpr bool is_sparse_hist = false;
+template <typename Bin>
+constexpr bool is_sparse_hist<sparse_hist<Bin>> = true;
+template <bool InitialState = true, bool PhotonCuts = true>
+using tags_t = // ***** define bin type *****
+  multiweight_tag<
+  initial_state_tag<
+  photon_cuts_tag<
+    basic_bin_t, PhotonCuts
+  >, InitialState >>;
+
+template <typename Bin>
+using hist_of = ivanp::hist::histogram<
+  Bin,
+  ivanp::hist::axes_spec< const axes_t& >,
+  ivanp::hist::flags_spec< ivanp::hist::hist_flags::perbin_axes >
+>;
+
+// Histogram with bins of the type matching its selection of tags
+class hist_t {
+  using variant_t = std::variant<
+    hist_of<dense_bin<tags_t<true ,true >>>,
+    hist_of<dense_bin<tags_t<true ,false>>>,
+    hist_of<dense_bin<tags_t<false,true >>>,
+    hist_of<dense_bin<tags_t<false,false>>>,
+    sparse_hist<tags_t<true ,true >>,
+    sparse_hist<tags_t<true ,false>>,
+    sparse_hist<tags_t<false,true >>,
+    sparse_hist<tags_t<false,false>>
+  >;
+  const hist_tags& _sel;
+  variant_t _h;
+
+  template <size_t I = 0>
+  static variant_t make(const axes_t& axes, const hist_tags& sel, size_t i) {
+    if constexpr (I+1 < std::variant_size_v<variant_t>)
+      if (i != I) return make<I+1>(axes,sel,i);
+    if constexpr (is_sparse_hist<std::variant_alternative_t<I,variant_t>>)
+      return variant_t(std::in_place_index<I>, axes, sel);
+    else
+      return variant_t(std::in_place_index<I>, axes);
+  }
+
+public:
+  hist_t(const axes_t& axes, const hist_tags& sel, bool sparse = false)
+  : _sel(sel), _h(make(axes, sel,
+      4*sparse + 2*!sel.initial_state + !sel.photon_cuts)) {
+    std::visit([&](auto& h){
+      if constexpr (!is_sparse_hist<std::decay_t<decltype(h)>>)
+        for (auto& bin : h)
+          bin = std::remove_reference_t<decltype(bin)>(sel);
+    },_h);
+  }
+
+  template <typename... X>
+  void operator()(const X&... x) {
+    std::visit([&](auto& h){ h(x...); },_h);
+  }
+  void finalize() {
+    std::visit([](auto& h){
+      if constexpr (is_sparse_hist<std::decay_t<decltype(h)>>)
+        h.finalize();
+      else for (auto& bin : h)
+        bin.finalize();
+    },_h);
+  }
+
+  template <typename F>
+  decltype(auto) visit(F&& f) { return std::visit(std::forward<F>(f),_h); }
+  template <typename F>
+  decltype(auto) visit(F&& f) const {
+    return std::visit(std::forward<F>(f),_h);
+  }
+
+  const hist_tags& sel() const noexcept { return _sel; }
+};
+
+// Zero bin for the unfilled cells of a histogram
+auto empty_cell(const auto& h, const hist_tags& sel) {
+  using bin_type = std::remove_cvref_t<decltype(*h.bins().begin())>;
+  return typename bin_type::cell_type(sel);
+}
+
+#endif
@@ -0,0 +1,148 @@
+// ------------------------------------------------------------------
+// SQL functions operating on histograms' bins stored as BLOBs by root2sql:
+// sums of weights for all bins, followed by sums of squared weights.
+//
+// Aggregate:
+//   hist_sum(bins)    bin by bin sum
+//   hist_min(bins)    bin by bin minimum
+//   hist_max(bins)    bin by bin maximum
+// Scalar:
+//   hist_add(bins, ...)        sum of the arguments
+//   hist_scale(bins, k)        sums of weights times k
+//   hist_json(bins)            JSON array of [ weights, squared weights ],
+//                              or NULL for empty bins
+//
+// For min and max, squared weights are taken from the same row
+// as the selected sum of weights.
+// NULL arguments are ignored. All other arguments must have the same size.
+// ------------------------------------------------------------------
+
+#ifndef HIST_SQL_HH
+#define HIST_SQL_HH
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+
+#include "ivanp/sqlite.hh"
+
+namespace hist_sql {
+
+using bins_t = std::vector<double>;
+
+// Number of doubles in a bins BLOB, or -1 for NULL
+inline int size(sqlite3_value* v) {
+  if (sqlite3_value_type(v) == SQLITE_NULL) return -1;
+  if (sqlite3_value_type(v) != SQLITE_BLOB)
+    throw std::runtime_error("hist: argument is not a BLOB");
+  const int n = sqlite3_value_bytes(v);
+  if (n % (2*sizeof(double)))
+    throw std::runtime_error("hist: BLOB size is not a multiple of 2 doubles");
+  return n / sizeof(double);
+}
+
+// Copy of the BLOB, since it is not guaranteed to be aligned
+inline void read(sqlite3_value* v, int n, double* out) {
+  memcpy(out, sqlite3_value_blob(v), n*sizeof(double));
+}
+
+inline void check_size(const bins_t& acc, int n) {
+  if (int(acc.size()) != n)
+    throw std::runtime_error(ivanp::cat(
+      "hist: bins size mismatch: ",
+      std::to_string(acc.size())," and ",std::to_string(n)));
+}
+
+inline void result(ivanp::sqlite::context& c, const bins_t& acc) {
+  if (acc.empty()) c.result(nullptr);
+  else c.result(acc.data(), acc.size()*sizeof(double));
+}
+
+// Accumulate into acc; op(acc,in,nw) for nw sums of weights
+template <typename Op>
+void accumulate(bins_t& acc, bins_t& buf, sqlite3_value* v, Op&& op) {
+  const int n = size(v);
+  if (n < 0) return;
+  if (acc.empty()) {
+    acc.resize(n);
+    read(v, n, acc.data());
+  } else {
+    check_size(acc, n);
+    buf.resize(n);
+    read(v, n, buf.data());
+    op(acc.data(), buf.data(), n/2);
+  }
+}
+
+inline void add(double* __restrict acc, const double* __restrict in, int nw) {
+  for (int i=0, n=nw*2; i<n; ++i) acc[i] += in[i];
+}
+template <typename Cmp>
+inline void select(double* acc, const double* in, int nw, Cmp cmp) {
+  for (int i=0; i<nw; ++i)
+    if (cmp(in[i], acc[i])) {
+      acc[i] = in[i];
+      acc[i+nw] = in[i+nw];
+    }
+}
+
+struct state { bins_t acc, buf; };
+
+inline void add_functions(ivanp::sqlite& db) {
+  auto final = [](state& s, ivanp::sqlite::context& c) { result(c, s.acc); };
+
+  db.aggregate<state>("hist_sum", 1,
+    [](state& s, auto&, int, sqlite3_value** argv) {
+      accumulate(s.acc, s.buf, argv[0], add);
+    }, final);
+  db.aggregate<state>("hist_min", 1,
+    [](state& s, auto&, int, sqlite3_value** argv) {
+      accumulate(s.acc, s.buf, argv[0], [](double* a, const double* b, int n){
+        select(a, b, n, [](double x, double y){ return x < y; });
+      });
+    }, final);
+  db.aggregate<state>("hist_max", 1,
+    [](state& s, auto&, int, sqlite3_value** argv) {
+      accumulate(s.acc, s.buf, argv[0], [](double* a, const double* b, int n){
+        select(a, b, n, [](double x, double y){ return x > y; });
+      });
+    }, final);
+
+  db.function("hist_add", -1,
+    [](ivanp::sqlite::context& c, int argc, sqlite3_value** argv) {
+      state s;
+      for (int i=0; i<argc; ++i)
+        accumulate(s.acc, s.buf, argv[i], add);
+      result(c, s.acc);
+    });
+  db.function("hist_scale", 2,
+    [](ivanp::sqlite::context& c, int, sqlite3_value** argv) {
+      const int n = size(argv[0]);
+      if (n < 0) return c.result(nullptr);
+      bins_t bins(n);
+      read(argv[0], n, bins.data());
+      const double k = sqlite3_value_double(argv[1]);
+      for (int i=0; i<n/2; ++i) bins[i] *= k;
+      for (int i=n/2; i<n; ++i) bins[i] *= k*k;
+      result(c, bins);
+    });
+  db.function("hist_json", 1,
+    [](ivanp::sqlite::context& c, int, sqlite3_value** argv) {
+      const int n = size(argv[0]);
+      if (n <= 0) return c.result(nullptr);
+      bins_t bins(n);
+      read(argv[0], n, bins.data());
+      std::stringstream ss;
+      ss.precision(17);
+      for (int i=0; i<n; ++i)
+        ss << (i ? (i==n/2 ? "],[" : ",") : "[[") << bins[i];
+      ss << "]]";
+      c.result(std::move(ss).str());
+    });
+}
+
+} // end namespace hist_sql
+
+#endif
@@ -0,0 +1,157 @@
+// ------------------------------------------------------------------
+// Histogram axes with constant-time bin lookup
+// - log_uniform_axis: bins uniform in log(x)
+// - lut_axis: arbitrary edges, searched via a uniform-grid lookup table
+// Written by Ivan Pogrebnyak
+// ------------------------------------------------------------------
+
+#ifndef IVANP_HIST_FAST_AXES_HH
+#define IVANP_HIST_FAST_AXES_HH
+
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+namespace ivanp::hist {
+
+template <typename Edge = double, typename Index = unsigned>
+class log_uniform_axis {
+public:
+  using edge_type = Edge;
+  using index_type = Index;
+
+private:
+  std::vector<edge_type> _edges;
+  edge_type _log_min = 0, _scale = 0;
+
+public:
+  log_uniform_axis() noexcept = default;
+  log_uniform_axis(edge_type min, edge_type max, index_type ndiv)
+  : _edges(ndiv+1), _log_min(std::log(min))
+  {
+    if (!(0 < min && min < max && ndiv > 0)) throw std::runtime_error(
+      "log axis requires 0 < min < max and ndiv > 0");
+    const edge_type log_max = std::log(max);
+    _scale = ndiv/(log_max - _log_min);
+    const edge_type d = (log_max - _log_min)/ndiv;
+    for (index_type i=1; i<ndiv; ++i)
+      _edges[i] = std::exp(_log_min + i*d);
+    _edges.front() = min;
+    _edges.back() = max;
+  }
+
+  index_type ndiv() const noexcept { return _edges.size()-1; }
+  index_type nbins() const noexcept { return _edges.size()+1; }
+  index_type nedges() const noexcept { return _edges.size(); }
+
+  const std::vector<edge_type>& edges() const noexcept { return _edges; }
+  edge_type edge(index_type i) const noexcept { return _edges[i]; }
+  edge_type min() const noexcept { return _edges.front(); }
+  edge_type max() const noexcept { return _edges.back(); }
+  edge_type lower(index_type i) const noexcept { return _edges[i-1]; }
+  edge_type upper(index_type i) const noexcept { return _edges[i]; }
+
+  index_type find_bin(edge_type x) const noexcept {
+    if (!(_edges.front() <= x)) return 0; // underflow or NaN
+    const index_type n = ndiv();
+    if (!(x < _edges.back())) return n+1;
+    index_type i = (std::log(x) - _log_min)*_scale;
+    // correct for rounding in log() near the edges
+    if (i >= n) i = n-1;
+    if (x < _edges[i]) --i;
+    else if (!(x < _edges[i+1])) ++i;
+    return i+1;
+  }
+  index_type operator()(edge_type x) const noexcept { return find_bin(x); }
+
+  bool operator==(const log_uniform_axis& o) const noexcept {
+    return _edges == o._edges;
+  }
+};
+
+// Arbitrary sorted edges with a lookup table mapping a uniform grid
+// over [min,max) to the bin containing the lower edge of each grid cell.
+// The grid cells are as narrow as the narrowest bin, up to max_lut_size
+// cells, so that a cell usually overlaps at most 2 bins. Within a cell,
+// the bins it overlaps are binary searched.
+template <typename Edge = double, typename Index = unsigned>
+class lut_axis {
+public:
+  using edge_type = Edge;
+  using index_type = Index;
+
+  static constexpr index_type max_lut_size = 1 << 16;
+
+private:
+  std::vector<edge_type> _edges;
+  std::vector<index_type> _lut;
+  edge_type _scale = 0;
+
+  void make_lut() {
+    const index_type n = ndiv();
+    if (!(n > 0)) throw std::runtime_error(
+      "lut axis requires at least 2 edges");
+    const edge_type range = _edges.back() - _edges.front();
+    edge_type min_width = range;
+    for (index_type i=0; i<n; ++i) {
+      const edge_type w = _edges[i+1] - _edges[i];
+      if (w > 0 && w < min_width) min_width = w;
+    }
+    const edge_type ncells = std::ceil(range/min_width);
+    index_type nlut = ncells < max_lut_size ? index_type(ncells) : max_lut_size;
+    if (nlut < n) nlut = n;
+    _scale = nlut/range;
+    _lut.resize(nlut+1);
+    for (index_type k=0, i=0; k<=nlut; ++k) {
+      const edge_type x = _edges.front() + k/_scale;
+      while (i+1 < n && !(x < _edges[i+1])) ++i;
+      _lut[k] = i;
+    }
+  }
+
+public:
+  lut_axis() noexcept = default;
+  lut_axis(std::vector<edge_type> edges): _edges(std::move(edges)) {
+    std::sort(_edges.begin(),_edges.end());
+    make_lut();
+  }
+  template <typename Axis>
+  requires requires (const Axis& a) { a.edges(); }
+  explicit lut_axis(const Axis& axis)
+  : lut_axis(std::vector<edge_type>(
+      axis.edges().begin(), axis.edges().end()
+    )) { }
+
+  index_type ndiv() const noexcept { return _edges.size()-1; }
+  index_type nbins() const noexcept { return _edges.size()+1; }
+  index_type nedges() const noexcept { return _edges.size(); }
+
+  const std::vector<edge_type>& edges() const noexcept { return _edges; }
+  edge_type edge(index_type i) const noexcept { return _edges[i]; }
+  edge_type min() const noexcept { return _edges.front(); }
+  edge_type max() const noexcept { return _edges.back(); }
+  edge_type lower(index_type i) const noexcept { return _edges[i-1]; }
+  edge_type upper(index_type i) const noexcept { return _edges[i]; }
+
+  index_type find_bin(edge_type x) const noexcept {
+    if (!(_edges.front() <= x)) return 0; // underflow or NaN
+    if (!(x < _edges.back())) return ndiv()+1;
+    index_type c = (x - _edges.front())*_scale;
+    if (c >= _lut.size()-1) c = _lut.size()-2;
+    // bins overlapping the cell, plus one on each side for rounding
+    const index_type lo = _lut[c] ? _lut[c]-1 : 0;
+    const index_type hi = std::min<index_type>(_lut[c+1]+1, ndiv()-1);
+    const edge_type* e = _edges.data();
+    return std::upper_bound(e+lo+1, e+hi+1, x) - e;
+  }
+  index_type operator()(edge_type x) const noexcept { return find_bin(x); }
+
+  bool operator==(const lut_axis& o) const noexcept {
+    return _edges == o._edges;
+  }
+};
+
+} // end namespace ivanp::hist
+
+#endif
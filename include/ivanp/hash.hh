@@ -0,0 +1,95 @@
+// ------------------------------------------------------------------
+// Fast 64 bit content hash, for detecting changes of files
+// Not cryptographic
+// Written by Ivan Pogrebnyak
+// ------------------------------------------------------------------
+
+#ifndef IVANP_HASH_HH
+#define IVANP_HASH_HH
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ivanp/string.hh"
+
+namespace ivanp {
+
+// Processes 8 bytes at a time
+struct hasher {
+  uint64_t h = 0x9E3779B97F4A7C15;
+
+  static uint64_t mix(uint64_t x) noexcept {
+    x ^= x >> 33; x *= 0xFF51AFD7ED558CCD;
+    x ^= x >> 33; x *= 0xC4CEB9FE1A85EC53;
+    x ^= x >> 33;
+    return x;
+  }
+  void add(uint64_t x) noexcept {
+    h = mix(h ^ x) + 0x9E3779B97F4A7C15;
+  }
+  void add(const char* p, size_t n) noexcept {
+    add(uint64_t(n));
+    for (; n>=8; p+=8, n-=8) {
+      uint64_t x;
+      memcpy(&x,p,8);
+      h = (h ^ x) * 0x100000001B3 + (h >> 29);
+    }
+    uint64_t x = 0;
+    memcpy(&x,p,n);
+    add(x);
+  }
+  void add(std::string_view s) noexcept { add(s.data(),s.size()); }
+  void add_file(const char* name) {
+    const int fd = ::open(name,O_RDONLY);
+    if (fd < 0) throw std::runtime_error(cat("cannot open ",name));
+    struct stat st;
+    if (::fstat(fd,&st)) {
+      ::close(fd);
+      throw std::runtime_error(cat("cannot stat ",name));
+    }
+    const size_t len = st.st_size;
+    void* addr = len ? ::mmap(nullptr,len,PROT_READ,MAP_PRIVATE,fd,0) : nullptr;
+    ::close(fd);
+    if (addr == MAP_FAILED) throw std::runtime_error(cat("cannot map ",name));
+    ::madvise(addr,len,MADV_SEQUENTIAL);
+    add(static_cast<const char*>(addr),len);
+    if (addr) ::munmap(addr,len);
+  }
+  // Size and modification time, a cheap check for changes of a file
+  void add_stamp(const char* name) {
+    struct stat st;
+    if (::stat(name,&st)) throw std::runtime_error(cat("cannot stat ",name));
+    add(uint64_t(st.st_size));
+    add(uint64_t(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec);
+  }
+
+  std::string str() const {
+    char s[17];
+    snprintf(s,sizeof(s),"%016lx",(unsigned long)h);
+    return s;
+  }
+};
+
+inline std::string file_hash(const char* name) {
+  hasher h;
+  h.add_file(name);
+  return h.str();
+}
+inline std::string file_stamp(const char* name) {
+  hasher h;
+  h.add_stamp(name);
+  return h.str();
+}
+
+} // end namespace ivanp
+
+#endif
@@ -0,0 +1,286 @@
+// ------------------------------------------------------------------
+// Sampled timing of code scopes, compiled out unless IVANP_PROF is defined
+//
+// PROF_INIT(file)       dump to file at exit and on SIGUSR1;
+//                       must be called before any threads are started
+// PROF_SCOPE(name)      time until the end of the enclosing scope
+// PROF_SCOPE_ID(site)   same, with a site returned by ivanp::prof::site()
+// PROF_STAGES(s,name)   time until the end of the enclosing scope,
+// PROF_STAGE(s,name)    split into consecutive stages
+//
+// Every thread has its own counters, so scopes don't synchronize.
+// All calls are counted, but only one in IVANP_PROF_SAMPLE (environment
+// variable, 16 by default) reads the clock. Sampled durations are collected
+// in histograms with power of 2 bins in nanoseconds.
+// ------------------------------------------------------------------
+
+#ifndef IVANP_PROF_HH
+#define IVANP_PROF_HH
+
+#ifdef IVANP_PROF
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <bit>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+
+#include <signal.h>
+#include <pthread.h>
+
+#include "ivanp/string.hh"
+
+namespace ivanp::prof {
+
+using clock = std::chrono::steady_clock;
+constexpr unsigned nbins = 48, chunk_size = 64, max_chunks = 1024,
+  max_sites = chunk_size*max_chunks;
+
+struct site_stats {
+  std::atomic<uint64_t> calls{}, sampled{}, sum{}, max{}; // sum and max in ns
+  std::array<std::atomic<uint64_t>,nbins> hist{};
+};
+// Sites of a thread, allocated in chunks on first use, as sites may be
+// added after the thread started. Only the thread itself allocates them.
+class thread_stats {
+  std::array<std::atomic<site_stats*>,max_chunks> chunks{};
+public:
+  thread_stats() = default;
+  ~thread_stats() {
+    for (auto& c : chunks) delete[] c.load(std::memory_order_relaxed);
+  }
+  thread_stats(const thread_stats&) = delete;
+  thread_stats& operator=(const thread_stats&) = delete;
+
+  site_stats& operator[](unsigned site) {
+    auto& c = chunks[site/chunk_size];
+    site_stats* p = c.load(std::memory_order_relaxed);
+    if (!p) [[unlikely]]
+      c.store(p = new site_stats[chunk_size], std::memory_order_release);
+    return p[site%chunk_size];
+  }
+  // nullptr if the site was never used by the thread
+  const site_stats* find(unsigned site) const noexcept {
+    const site_stats* p =
+      chunks[site/chunk_size].load(std::memory_order_acquire);
+    return p ? p + site%chunk_size : nullptr;
+  }
+};
+
+// Counters are only written by their own thread, and read when dumped
+inline void add(std::atomic<uint64_t>& a, uint64_t x) noexcept {
+  a.store(a.load(std::memory_order_relaxed)+x, std::memory_order_relaxed);
+}
+
+inline uint64_t sample_mask = 15;
+
+class registry {
+  std::mutex mx;
+  std::vector<std::string> names;
+  std::vector<std::unique_ptr<thread_stats>> threads;
+  std::string filename;
+  std::thread dumper;
+  std::atomic<bool> stop = false;
+
+public:
+  ~registry() {
+    if (!dumper.joinable()) return;
+    stop = true;
+    pthread_kill(dumper.native_handle(),SIGUSR1);
+    dumper.join();
+    dump();
+  }
+
+  void init(std::string file) {
+    if (dumper.joinable()) throw std::runtime_error(
+      "prof: already initialized");
+    filename = std::move(file);
+    if (const char* s = std::getenv("IVANP_PROF_SAMPLE"))
+      sample_mask = std::bit_ceil(uint64_t(std::max(std::atol(s),1l))) - 1;
+
+    // threads started after this inherit the mask,
+    // and SIGUSR1 is only received by the dumper
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set,SIGUSR1);
+    pthread_sigmask(SIG_BLOCK,&set,nullptr);
+    dumper = std::thread([this,set]{
+      for (int sig; !sigwait(&set,&sig) && !stop; ) dump();
+    });
+  }
+
+  unsigned site(std::string_view name) {
+    std::lock_guard lock(mx);
+    for (unsigned i=0; i<names.size(); ++i)
+      if (names[i] == name) return i;
+    if (names.size() == max_sites) throw std::runtime_error(cat(
+      "prof: more than ",std::to_string(max_sites)," sites"));
+    names.emplace_back(name);
+    return names.size()-1;
+  }
+
+  thread_stats* add_thread() {
+    std::lock_guard lock(mx);
+    return threads.emplace_back(std::make_unique<thread_stats>()).get();
+  }
+
+  // Written to a temporary file first, so the file is always complete
+  void dump() {
+    std::lock_guard lock(mx);
+    if (filename.empty()) return;
+    const std::string tmp = filename + ".tmp";
+    std::ofstream f(tmp);
+    f << "{\"sample\":" << (sample_mask+1) << ",\"threads\":[";
+    for (unsigned t=0; t<threads.size(); ++t) {
+      f << (t ? ",\n" : "\n") << "{";
+      bool first = true;
+      for (unsigned i=0; i<names.size(); ++i) {
+        const site_stats* sp = threads[t]->find(i);
+        if (!sp) continue;
+        const auto& s = *sp;
+        const uint64_t calls = s.calls.load(std::memory_order_relaxed);
+        if (!calls) continue;
+        const uint64_t n = s.sampled.load(std::memory_order_relaxed);
+        const uint64_t sum = s.sum.load(std::memory_order_relaxed);
+        f << (first ? "\n" : ",\n") << " \"" << names[i] << "\":{"
+          "\"calls\":" << calls << ",\"sampled\":" << n <<
+          ",\"sum_ns\":" << sum <<
+          ",\"max_ns\":" << s.max.load(std::memory_order_relaxed) <<
+          ",\"est_total_s\":" << (n ? sum*1e-9*calls/n : 0.) <<
+          ",\"hist\":[";
+        // [ upper edge in ns, count ] for nonempty bins
+        bool first_bin = true;
+        for (unsigned b=0; b<nbins; ++b) {
+          const uint64_t c = s.hist[b].load(std::memory_order_relaxed);
+          if (!c) continue;
+          f << (first_bin ? "" : ",") << '[' << (uint64_t(1)<<b) << ','
+            << c << ']';
+          first_bin = false;
+        }
+        f << "]}";
+        first = false;
+      }
+      f << "\n}";
+    }
+    f << "\n]}\n";
+    f.close();
+    if (f) std::rename(tmp.c_str(),filename.c_str());
+  }
+};
+
+inline registry& reg() {
+  static registry r;
+  return r;
+}
+
+inline void init(std::string filename) { reg().init(std::move(filename)); }
+inline unsigned site(std::string_view name) { return reg().site(name); }
+
+inline thread_stats& local() noexcept {
+  thread_local thread_stats* p = reg().add_thread();
+  return *p;
+}
+
+// Count a call, and return whether it is sampled
+inline bool count(site_stats& s) noexcept {
+  const uint64_t n = s.calls.load(std::memory_order_relaxed);
+  s.calls.store(n+1, std::memory_order_relaxed);
+  return !(n & sample_mask);
+}
+
+inline void record(site_stats& s, clock::duration d) noexcept {
+  const uint64_t ns = std::chrono::nanoseconds(d).count();
+  add(s.sampled,1);
+  add(s.sum,ns);
+  if (ns > s.max.load(std::memory_order_relaxed))
+    s.max.store(ns, std::memory_order_relaxed);
+  add(s.hist[std::min<unsigned>(std::bit_width(ns),nbins-1)],1);
+}
+
+class scope {
+  site_stats* s;
+  clock::time_point t0;
+public:
+  explicit scope(unsigned site): s(&local()[site]) {
+    if (count(*s)) t0 = clock::now();
+    else s = nullptr;
+  }
+  ~scope() { if (s) record(*s, clock::now()-t0); }
+  scope(const scope&) = delete;
+  scope& operator=(const scope&) = delete;
+};
+
+// Whole scope split into stages; stages are sampled with the whole
+class stages {
+  thread_stats& t;
+  site_stats *whole, *current = nullptr;
+  clock::time_point t0, t1;
+  bool sampled;
+public:
+  explicit stages(unsigned site)
+  : t(local()), whole(&t[site]), sampled(count(*whole)) {
+    if (sampled) t0 = t1 = clock::now();
+  }
+  ~stages() {
+    if (!sampled) return;
+    const auto now = clock::now();
+    if (current) record(*current, now-t1);
+    record(*whole, now-t0);
+  }
+  stages(const stages&) = delete;
+  stages& operator=(const stages&) = delete;
+
+  // End the current stage and start the next one
+  void operator()(unsigned site) {
+    auto& s = t[site];
+    add(s.calls,1);
+    if (!sampled) return;
+    const auto now = clock::now();
+    if (current) record(*current, now-t1);
+    current = &s;
+    t1 = now;
+  }
+};
+
+} // end namespace ivanp::prof
+
+#define PROF_CAT1(a,b) a##b
+#define PROF_CAT(a,b) PROF_CAT1(a,b)
+
+#define PROF_INIT(file) ivanp::prof::init(file);
+#define PROF_SCOPE_ID(site) \
+  ivanp::prof::scope PROF_CAT(prof_scope_,__LINE__)(site);
+#define PROF_SCOPE(name) \
+  static const unsigned PROF_CAT(prof_site_,__LINE__) = \
+    ivanp::prof::site(name); \
+  PROF_SCOPE_ID(PROF_CAT(prof_site_,__LINE__))
+#define PROF_STAGES(s,name) \
+  static const unsigned PROF_CAT(prof_site_,__LINE__) = \
+    ivanp::prof::site(name); \
+  ivanp::prof::stages s(PROF_CAT(prof_site_,__LINE__));
+#define PROF_STAGE(s,name) { \
+    static const unsigned site = ivanp::prof::site(name); \
+    s(site); \
+  }
+
+#else
+
+#define PROF_INIT(file)
+#define PROF_SCOPE_ID(site)
+#define PROF_SCOPE(name)
+#define PROF_STAGES(s,name)
+#define PROF_STAGE(s,name)
+
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+// ------------------------------------------------------------------
+// Utilities for writing ROOT output files
+// - compression settings from strings like "zstd:5"
+// - background_writer: writes objects on a separate thread, so that
+//   compression overlaps with creation of the next objects
+// Written by Ivan Pogrebnyak
+// ------------------------------------------------------------------
+
+#ifndef IVANP_ROOT_OUTPUT_HH
+#define IVANP_ROOT_OUTPUT_HH
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <charconv>
+#include <algorithm>
+
+#include <TFile.h>
+#include <TROOT.h>
+#include <Compression.h>
+
+#include "ivanp/string.hh"
+
+namespace ivanp {
+
+// Parse compression specification of the form "algorithm[:level]",
+// where algorithm is one of none, zlib, lz4, zstd, lzma.
+// If the level is omitted, a default for the algorithm is used.
+inline int root_compression(std::string_view spec) {
+  const auto colon = spec.find(':');
+  const std::string_view alg = spec.substr(0,colon);
+  int level = -1;
+  if (colon != std::string_view::npos) {
+    const char *a = spec.data()+colon+1, *b = spec.data()+spec.size();
+    const auto [ptr,ec] = std::from_chars(a,b,level);
+    if (ec != std::errc{} || ptr != b || level < 0 || level > 9)
+      throw std::runtime_error(cat(
+        "invalid compression level in \"",spec,"\""));
+  }
+  struct alg_def { ROOT::ECompressionAlgorithm alg; int level; };
+  static const std::map<std::string_view,alg_def> algs {
+    { "none", { ROOT::kUseGlobal, 0 } },
+    { "zlib", { ROOT::kZLIB, 1 } },
+    { "lz4" , { ROOT::kLZ4 , 4 } },
+    { "zstd", { ROOT::kZSTD, 5 } },
+    { "lzma", { ROOT::kLZMA, 9 } }
+  };
+  const auto it = algs.find(alg);
+  if (it == algs.end()) throw std::runtime_error(cat(
+    "unknown compression algorithm \"",alg,"\""));
+  const auto& def = it->second;
+  if (level < 0) level = def.level;
+  return level ? def.alg*100 + level : 0;
+}
+
+inline void set_compression(TFile& f, std::string_view spec) {
+  f.SetCompressionSettings(root_compression(spec));
+}
+
+// Writes objects to a file on a separate thread.
+// Objects must not be attached to any directory.
+// They are deleted after being written.
+// Directories are referred to by their paths relative to the file,
+// and are created as needed, or in advance by mkdir().
+// At most max_queued objects wait to be written; adding more blocks
+// until the writer catches up.
+// All access to the file has to go through the writer while it is running.
+class background_writer {
+  TFile* file;
+  std::map<std::string,TDirectory*> dirs;
+  std::deque<std::pair<std::string,TObject*>> queue;
+  size_t max_queued;
+  std::mutex mx;
+  std::condition_variable cv, cv_space;
+  bool done = false;
+  std::thread thread;
+
+  TDirectory* get_dir(const std::string& path) {
+    if (path.empty()) return file;
+    auto [it,inserted] = dirs.try_emplace(path);
+    if (inserted) {
+      const auto slash = path.rfind('/');
+      TDirectory* parent = slash==std::string::npos
+        ? file : get_dir(path.substr(0,slash));
+      it->second = parent->mkdir(path.c_str()+(slash+1));
+    }
+    return it->second;
+  }
+
+  void run() {
+    for (;;) {
+      std::unique_lock lock(mx);
+      cv.wait(lock,[this]{ return done || !queue.empty(); });
+      if (queue.empty()) return; // done
+      auto [path,obj] = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      cv_space.notify_one();
+
+      TDirectory* dir = get_dir(path);
+      if (obj) {
+        dir->WriteTObject(obj);
+        delete obj;
+      }
+    }
+  }
+
+  void push(std::string dir, TObject* obj) {
+    { std::unique_lock lock(mx);
+      cv_space.wait(lock,[this]{ return queue.size() < max_queued; });
+      queue.emplace_back(std::move(dir),obj);
+    }
+    cv.notify_one();
+  }
+
+public:
+  background_writer(TFile& f, size_t max_queued = 64)
+  : file(&f), max_queued(std::max(max_queued,size_t(1))) {
+    ROOT::EnableThreadSafety();
+    thread = std::thread(&background_writer::run,this);
+  }
+  ~background_writer() { join(); }
+  background_writer(const background_writer&) = delete;
+  background_writer& operator=(const background_writer&) = delete;
+
+  void operator()(std::string dir, TObject* obj) {
+    push(std::move(dir),obj);
+  }
+
+  // Create a directory, even if nothing is going to be written to it
+  void mkdir(std::string dir) { push(std::move(dir),nullptr); }
+
+  // Wait for all queued objects to be written
+  void join() {
+    if (!thread.joinable()) return;
+    { std::lock_guard lock(mx);
+      done = true;
+    }
+    cv.notify_one();
+    thread.join();
+  }
+};
+
+} // end namespace ivanp
+
+#endif
@@ -4,6 +4,12 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <optional>
+#include <tuple>
+#include <ranges>
 
 #include "sqlite3.h"
 // https://sqlite.org/cintro.html
@@ -38,6 +44,7 @@ public:
       THROW_SQLITE("sqlite3_open");
   }
   ~sqlite() {
+    clear_cache(); // statements must be finalized before closing
     if (sqlite3_close(db) != SQLITE_OK)
       std::cerr << STR(__LINE__) ": sqlite3_close(): "
         << errmsg() << std::endl;
@@ -46,9 +53,12 @@ public:
   sqlite& operator=(const sqlite&) = delete;
   sqlite& operator=(sqlite&& o) noexcept {
     std::swap(db,o.db);
+    std::swap(cache,o.cache);
+    std::swap(cache_index,o.cache_index);
+    std::swap(cache_cap,o.cache_cap);
     return *this;
   }
-  sqlite(sqlite&& o) noexcept { std::swap(db,o.db); }
+  sqlite(sqlite&& o) noexcept { *this = std::move(o); }
 
   sqlite3* operator+() noexcept { return db; }
   const sqlite3* operator+() const noexcept { return db; }
@@ -114,6 +124,17 @@ public:
     }
   };
 
+  // Bound as a BLOB, rather than TEXT
+  struct blob {
+    const void* data;
+    int size;
+    blob(const void* data, int size) noexcept: data(data), size(size) { }
+    template <std::ranges::contiguous_range R>
+    explicit blob(const R& r) noexcept
+    : data(std::ranges::data(r)),
+      size(std::ranges::size(r)*sizeof(std::ranges::range_value_t<R>)) { }
+  };
+
   class stmt {
     sqlite3_stmt *p = nullptr;
 
@@ -126,19 +147,22 @@ public:
         db, sql, -1,
         persist ? SQLITE_PREPARE_PERSISTENT : 0,
         &p, nullptr
-      ) != SQLITE_OK) THROW_SQLITE("sqlite3_prepare_v3");
+      ) != SQLITE_OK) // p is null, so errmsg() can't be used
+        THROW_SQLITE_MSG("sqlite3_prepare_v3",sqlite3_errmsg(db));
     }
     stmt(sqlite3 *db, std::string_view sql, bool persist=false) {
       if (sqlite3_prepare_v3(
         db, sql.data(), sql.size(),
         persist ? SQLITE_PREPARE_PERSISTENT : 0,
         &p, nullptr
-      ) != SQLITE_OK) THROW_SQLITE("sqlite3_prepare_v3");
+      ) != SQLITE_OK) // p is null, so errmsg() can't be used
+        THROW_SQLITE_MSG("sqlite3_prepare_v3",sqlite3_errmsg(db));
     }
     ~stmt() {
+      sqlite3* db = p ? db_handle() : nullptr; // p is freed by finalize
       if (sqlite3_finalize(p) != SQLITE_OK)
       std::cerr << STR(__LINE__) ": sqlite3_finalize(): "
-        << errmsg() << std::endl;
+        << sqlite3_errmsg(db) << std::endl;
     }
 
     stmt(const stmt&) = delete;
@@ -218,6 +242,9 @@ public:
         THROW_SQLITE("sqlite3_bind_blob");
       return *this;
     }
+    stmt& bind(int i, blob x, bool trans=true) {
+      return bind(i, x.data, x.size, trans);
+    }
     stmt& bind(int i, std::nullptr_t, int n) {
       if (sqlite3_bind_zeroblob(p, i, n) != SQLITE_OK)
         THROW_SQLITE("sqlite3_bind_zeroblob");
@@ -315,6 +342,212 @@ public:
 
   stmt prepare(auto sql, bool persist=false) { return { db, sql, persist }; }
 
+private:
+  // LRU cache of prepared statements, most recently used first
+  std::list<std::pair<std::string,stmt>> cache;
+  std::unordered_map<std::string_view,decltype(cache)::iterator> cache_index;
+  size_t cache_cap = 32;
+
+public:
+  // Prepared statement from the cache, or prepared and added to it.
+  // The returned reference is valid until cache_capacity() other
+  // statements are requested.
+  stmt& cached(std::string_view sql) {
+    auto it = cache_index.find(sql);
+    if (it != cache_index.end()) {
+      cache.splice(cache.begin(),cache,it->second);
+      return it->second->second.reset().clear();
+    }
+    if (cache.size() >= cache_cap && !cache.empty()) {
+      cache_index.erase(cache.back().first);
+      cache.pop_back();
+    }
+    std::string key(sql);
+    stmt s(db, std::string_view(key), true);
+    cache.emplace_front(std::move(key),std::move(s));
+    cache_index.emplace(cache.front().first,cache.begin());
+    return cache.front().second;
+  }
+  void cache_capacity(size_t n) {
+    cache_cap = n;
+    while (cache.size() > n) {
+      cache_index.erase(cache.back().first);
+      cache.pop_back();
+    }
+  }
+  void clear_cache() noexcept {
+    cache_index.clear();
+    cache.clear();
+  }
+
+  // configuration --------------------------------------------------
+  // https://sqlite.org/pragma.html
+  sqlite& pragma(std::string_view name, std::string_view value) {
+    return exec(cat("PRAGMA ",name,'=',value,';').c_str());
+  }
+  // DELETE, TRUNCATE, PERSIST, MEMORY, WAL, or OFF
+  sqlite& journal_mode(std::string_view mode) {
+    return pragma("journal_mode",mode);
+  }
+  sqlite& wal() { return journal_mode("WAL"); }
+  // OFF, NORMAL, FULL, or EXTRA
+  sqlite& synchronous(std::string_view mode) {
+    return pragma("synchronous",mode);
+  }
+  sqlite& mmap_size(sqlite3_int64 bytes) {
+    return pragma("mmap_size",std::to_string(bytes));
+  }
+  // wait for locks held by other connections, instead of failing
+  sqlite& busy_timeout(int ms) {
+    if (sqlite3_busy_timeout(db, ms) != SQLITE_OK)
+      THROW_SQLITE("sqlite3_busy_timeout");
+    return *this;
+  }
+
+  // transactions ---------------------------------------------------
+  // Rolled back on destruction, unless committed
+  class transaction {
+    sqlite* db;
+
+  public:
+    transaction(sqlite& db, const char* begin = "BEGIN;"): db(&db) {
+      db.exec(begin);
+    }
+    ~transaction() {
+      if (db) try {
+        db->exec("ROLLBACK;");
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+    transaction(const transaction&) = delete;
+    transaction& operator=(const transaction&) = delete;
+
+    void commit() {
+      db->exec("COMMIT;");
+      db = nullptr;
+    }
+  };
+
+  bool autocommit() const noexcept { return sqlite3_get_autocommit(db); }
+
+  // Bulk insert ----------------------------------------------------
+  // Execute sql for every row of the columns, binding the i-th element
+  // of every column to the statement's parameters in order.
+  // Runs in a single transaction, unless one is already open.
+  template <std::ranges::random_access_range... Cols>
+  requires (sizeof...(Cols) > 0)
+  sqlite& insert(std::string_view sql, const Cols&... cols) {
+    const size_t n = std::ranges::size(
+      std::get<0>(std::forward_as_tuple(cols...)));
+    if (((std::ranges::size(cols) != n) || ...))
+      throw sqlite_error(STR(__LINE__)": insert(): columns' sizes differ");
+
+    std::optional<transaction> t;
+    if (autocommit()) t.emplace(*this);
+    stmt& s = cached(sql);
+    for (size_t i=0; i<n; ++i) {
+      s.reset();
+      int j = 0;
+      (s.bind(++j,std::ranges::begin(cols)[i]), ...);
+      s.step();
+    }
+    s.reset().clear();
+    if (t) t->commit();
+    return *this;
+  }
+
+  // user defined functions -----------------------------------------
+  // https://sqlite.org/appfunc.html
+  class context {
+    sqlite3_context* p;
+
+  public:
+    context(sqlite3_context* p) noexcept: p(p) { }
+
+    sqlite3_context* operator+() noexcept { return p; }
+
+    void result(double x) noexcept { sqlite3_result_double(p, x); }
+    template <typename T> requires std::is_integral_v<T>
+    void result(T x) noexcept {
+      if constexpr (sizeof(T) < 8) sqlite3_result_int(p, x);
+      else sqlite3_result_int64(p, x);
+    }
+    void result(std::nullptr_t) noexcept { sqlite3_result_null(p); }
+    void result(std::string_view x) noexcept {
+      sqlite3_result_text(p, x.data(), x.size(), SQLITE_TRANSIENT);
+    }
+    void result(const void* x, int n) noexcept {
+      sqlite3_result_blob(p, x, n, SQLITE_TRANSIENT);
+    }
+    void error(const char* msg) noexcept { sqlite3_result_error(p, msg, -1); }
+  };
+
+  // Scalar function, f(context&, int argc, sqlite3_value** argv)
+  // nargs = -1 for any number of arguments
+  template <typename F>
+  sqlite& function(
+    const char* name, int nargs, F&& f,
+    int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC
+  ) {
+    using fn_t = std::decay_t<F>;
+    if (sqlite3_create_function_v2(db, name, nargs, flags,
+      new fn_t(std::forward<F>(f)),
+      +[](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+        context c(ctx);
+        try {
+          (*static_cast<fn_t*>(sqlite3_user_data(ctx)))(c,argc,argv);
+        } catch (const std::exception& e) {
+          c.error(e.what());
+        }
+      }, nullptr, nullptr,
+      +[](void* f) { delete static_cast<fn_t*>(f); }
+    ) != SQLITE_OK) THROW_SQLITE("sqlite3_create_function_v2");
+    return *this;
+  }
+
+  // Aggregate function with state of type T, default constructed per group
+  // step(T&, context&, int argc, sqlite3_value** argv)
+  // final(T&, context&)
+  template <typename T, typename Step, typename Final>
+  sqlite& aggregate(
+    const char* name, int nargs, Step&& step, Final&& final,
+    int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC
+  ) {
+    using fns_t = std::pair<std::decay_t<Step>,std::decay_t<Final>>;
+    if (sqlite3_create_function_v2(db, name, nargs, flags,
+      new fns_t(std::forward<Step>(step),std::forward<Final>(final)),
+      nullptr,
+      +[](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+        context c(ctx);
+        T** state = static_cast<T**>(
+          sqlite3_aggregate_context(ctx, sizeof(T*)));
+        if (!state) return sqlite3_result_error_nomem(ctx);
+        try {
+          if (!*state) *state = new T();
+          static_cast<fns_t*>(sqlite3_user_data(ctx))->first(
+            **state,c,argc,argv);
+        } catch (const std::exception& e) {
+          c.error(e.what());
+        }
+      },
+      +[](sqlite3_context* ctx) {
+        context c(ctx);
+        T** state = static_cast<T**>(sqlite3_aggregate_context(ctx, 0));
+        T* x = state ? *state : nullptr;
+        try {
+          if (!x) x = new T(); // no rows
+          static_cast<fns_t*>(sqlite3_user_data(ctx))->second(*x,c);
+        } catch (const std::exception& e) {
+          c.error(e.what());
+        }
+        delete x;
+      },
+      +[](void* f) { delete static_cast<fns_t*>(f); }
+    ) != SQLITE_OK) THROW_SQLITE("sqlite3_create_function_v2");
+    return *this;
+  }
+
   template <typename F>
   sqlite& exec(const char* sql, F&& f) {
     char* err;
@@ -4,8 +4,13 @@
 #include <chrono>
 #include <sstream>
 #include <locale>
+#include <string>
+#include <functional>
+#include <algorithm>
 #include <cstdio>
 
+#include <unistd.h>
+
 namespace ivanp {
 
 template <typename Counter = unsigned>
@@ -18,16 +23,53 @@ public:
 
 private:
   value_type cnt{}, cnt_start{}, cnt_end{};
-  time_type t_start = clock_type::now(), t_last = t_start;
+  time_type t_start = clock_type::now(), t_last = t_start, t_check = t_start;
+  double stride = 1; // counts between reads of the clock
+  unsigned long countdown = 1;
   std::stringstream ss;
   unsigned width[3]{};
-
-public:
-  void print(bool check=true) {
+  // in log files, progress is printed on new lines, once a minute
+  const bool tty = isatty(fileno(stdout));
+  std::string status_file;
+  std::function<double()> bytes_read;
+
+  // The clock is read every stride counts,
+  // with the stride adapted to read it about 10 times per second
+  void tick() {
+    if (--countdown) return;
     const auto now = clock_type::now();
-    if (check && sec_type(now-t_last).count() < 1) return;
-    t_last = now;
+    const double dt = sec_type(now-t_check).count();
+    t_check = now;
+    stride = std::clamp(stride*0.1/std::max(dt,1e-6), 1., stride*2);
+    countdown = stride;
+    print(now,true);
+  }
+
+  void write_status(double dt) {
+    const double n = cnt-cnt_start, total = cnt_end-cnt_start;
+    const double rate = dt > 0 ? n/dt : 0;
+    const std::string tmp = status_file + ".tmp";
+    FILE* f = fopen(tmp.c_str(),"w");
+    if (!f) return;
+    fprintf(f,"{\"count\":%.0f,\"total\":%.0f,\"elapsed\":%.3f,"
+      "\"per_second\":%.6g,\"eta\":",n,total,dt,rate);
+    if (rate > 0) fprintf(f,"%.3f",(total-n)/rate);
+    else fputs("null",f);
+    if (bytes_read) fprintf(f,",\"bytes_read\":%.0f",bytes_read());
+    fprintf(f,",\"done\":%s}\n",done() ? "true" : "false");
+    if (!fclose(f)) rename(tmp.c_str(),status_file.c_str());
+  }
+
+  void print(time_type now, bool check) {
     const auto dt = sec_type(now-t_start).count();
+    if (!status_file.empty()) { // written every 10 seconds
+      if (check && sec_type(now-t_last).count() < 10) return;
+      t_last = now;
+      write_status(dt);
+      return;
+    }
+    if (check && sec_type(now-t_last).count() < (tty ? 1 : 60)) return;
+    t_last = now;
     const int hours   = dt/3600;
     const int minutes = (dt-hours*3600)/60;
     const int seconds = (dt-hours*3600-minutes*60);
@@ -61,12 +103,27 @@ prt_sec:
     else ss.fill(' ');
 prt_ms: ;
 
-    putchar('\r');
     const auto& s = ss.str();
-    printf(s.c_str());
-    for (int i=width[2]-s.size(); i>0; --i) putchar(' ');
+    if (tty) {
+      putchar('\r');
+      printf(s.c_str());
+      for (int i=width[2]-s.size(); i>0; --i) putchar(' ');
+      width[2] = s.size();
+    } else {
+      puts(s.c_str());
+    }
     fflush(stdout);
-    width[2] = s.size();
+  }
+
+public:
+  void print(bool check=true) { print(clock_type::now(),check); }
+
+  // Write progress as JSON to a file, instead of printing it:
+  // count, total, elapsed seconds, count per second, ETA in seconds,
+  // bytes read, if the function is given, and whether the count is done.
+  void status(std::string file, std::function<double()> bytes = { }) {
+    status_file = std::move(file);
+    bytes_read = std::move(bytes);
   }
 
 private:
@@ -96,9 +153,15 @@ public:
   : cnt(i), cnt_start(i), cnt_end(n) { init(); }
   tcnt(value_type n) noexcept
   : cnt{}, cnt_start{}, cnt_end(n) { init(); }
+  // with status written to a file, unless the name is empty
+  tcnt(value_type n, std::string status_file,
+       std::function<double()> bytes_read = { })
+  : cnt{}, cnt_start{}, cnt_end(n),
+    status_file(std::move(status_file)), bytes_read(std::move(bytes_read))
+  { init(); }
   ~tcnt() {
     print(false);
-    puts("\n");
+    if (tty && status_file.empty()) puts("\n");
   }
 
   void reset(value_type i, value_type n) noexcept {
@@ -106,9 +169,11 @@ public:
     cnt_start = i;
     cnt_end = n;
     t_start = clock_type::now();
-    t_last = t_start;
+    t_last = t_check = t_start;
+    stride = countdown = 1;
   }
   void reset(value_type n) noexcept { reset({},n); }
+  void set_end(value_type n) noexcept { cnt_end = n; }
 
   bool done() const noexcept { return !(cnt < cnt_end); }
   bool operator!() const noexcept { return done(); }
@@ -118,17 +183,17 @@ public:
   value_type operator*() const noexcept { return cnt; }
 
   // prefix
-  value_type operator++() { print(); return ++cnt; }
-  value_type operator--() { print(); return --cnt; }
+  value_type operator++() { tick(); return ++cnt; }
+  value_type operator--() { tick(); return --cnt; }
 
   // postfix
-  value_type operator++(int) { print(); return cnt++; }
-  value_type operator--(int) { print(); return cnt--; }
+  value_type operator++(int) { tick(); return cnt++; }
+  value_type operator--(int) { tick(); return cnt--; }
 
   template <typename T>
-  value_type operator+=(T i) { print(); return cnt += i; }
+  value_type operator+=(T i) { tick(); return cnt += i; }
   template <typename T>
-  value_type operator-=(T i) { print(); return cnt -= i; }
+  value_type operator-=(T i) { tick(); return cnt -= i; }
 
   template <typename T>
   bool operator==(T i) const noexcept { return cnt == i; }
@@ -146,6 +211,8 @@ public:
 
 template <typename T> tcnt(T end) -> tcnt<T>;
 template <typename T> tcnt(T start, T end) -> tcnt<T>;
+template <typename T, typename... Args>
+tcnt(T end, std::string, Args&&...) -> tcnt<T>;
 
 } // end namespace
 
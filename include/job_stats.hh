@@ -0,0 +1,90 @@
+// ------------------------------------------------------------------
+// Timing and resource usage of a histogramming job, for the summary
+// written next to its output. The job's wall time is split into stages,
+// and the event loop's time is further split between the input files.
+// ------------------------------------------------------------------
+
+#ifndef JOB_STATS_HH
+#define JOB_STATS_HH
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <nlohmann/json.hpp>
+
+class job_stats {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct file_stats {
+    long unsigned entries = 0;
+    double wall = 0; // seconds spent in the event loop on this file
+  };
+
+private:
+  const double t_unix = std::chrono::duration<double>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  clock::time_point t_start = clock::now(), t_stage = t_start, t_file;
+  std::vector<std::pair<std::string,double>> stages;
+  std::vector<file_stats> files;
+  int file = -1;
+
+  static double seconds(clock::duration d) noexcept {
+    return std::chrono::duration<double>(d).count();
+  }
+
+public:
+  explicit job_stats(unsigned nfiles = 0): files(nfiles) { }
+
+  void resize(unsigned nfiles) { files.resize(nfiles); }
+
+  // End the current stage
+  void stage(std::string name) {
+    const auto now = clock::now();
+    stages.emplace_back(std::move(name), seconds(now-t_stage));
+    t_stage = now;
+  }
+
+  // Count an entry read from file i.
+  // The clock is only read when the file changes.
+  void entry(int i) noexcept {
+    if (i != file) [[unlikely]] set_file(i);
+    ++files[i].entries;
+  }
+  // Switch to file i, or stop timing files if i is negative
+  void set_file(int i) noexcept {
+    const auto now = clock::now();
+    if (file >= 0) files[file].wall += seconds(now-t_file);
+    file = i;
+    t_file = now;
+  }
+
+  const std::vector<file_stats>& per_file() const noexcept { return files; }
+
+  // Wall and CPU time in seconds, and maximum resident set size in kB
+  nlohmann::json json() const {
+    rusage ru { };
+    getrusage(RUSAGE_SELF,&ru);
+    auto sec = [](const timeval& t){ return t.tv_sec + t.tv_usec*1e-6; };
+
+    char host[256] { };
+    gethostname(host,sizeof(host)-1);
+
+    nlohmann::json j {
+      { "host", host },
+      { "time", t_unix },
+      { "wall", seconds(clock::now()-t_start) },
+      { "cpu", sec(ru.ru_utime) + sec(ru.ru_stime) },
+      { "max_rss", ru.ru_maxrss }
+    };
+    auto& js = j["stages"] = nlohmann::json::object();
+    for (const auto& [name,t] : stages) js[name] = t;
+    return j;
+  }
+};
+
+#endif
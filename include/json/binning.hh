@@ -23,46 +23,77 @@ struct adl_serializer< ivanp::hist::uniform_axis<> > {
   }
 };
 
+template <>
+struct adl_serializer< ivanp::hist::log_uniform_axis<> > {
+  using axis_t = ivanp::hist::log_uniform_axis<>;
+  static void from_json(const json& j, axis_t& axis) {
+    if (!(j.is_array() && j.size()==4 && j[0]=="log"))
+      throw std::runtime_error(
+        "log axis definition must be of the form [\"log\",min,max,ndiv]");
+    axis = axis_t(j[1],j[2],j[3]);
+  }
+};
+
 template <>
 struct adl_serializer<
   ivanp::hist::variant_axis<
     ivanp::hist::uniform_axis<>,
-    ivanp::hist::cont_axis<>
+    ivanp::hist::cont_axis<>,
+    ivanp::hist::log_uniform_axis<>,
+    ivanp::hist::lut_axis<>
   >
 > {
   using uniform_axis = ivanp::hist::uniform_axis<>;
   using cont_axis = ivanp::hist::cont_axis<>;
-  using axis_t = ivanp::hist::variant_axis< uniform_axis, cont_axis >;
+  using log_axis = ivanp::hist::log_uniform_axis<>;
+  using lut_axis = ivanp::hist::lut_axis<>;
+  using axis_t = ivanp::hist::variant_axis<
+    uniform_axis, cont_axis, log_axis, lut_axis >;
+
+  // use binary search only for axes with few edges
+  static constexpr unsigned max_cont_nedges = 16;
 
   static void from_json(const json& j, axis_t& axis) {
     uniform_axis u;
+    log_axis l;
     cont_axis c;
     if (!(j.is_array() && j.size())) throw std::runtime_error(
       "axis definition must be a non-empty array");
     if (j.size()>1) c.edges().reserve(j.size());
-    bool uniform = false;
+    enum { none, uniform, log } range = none;
+    auto add_range = [&]{
+      if (range==uniform) c += u;
+      else if (range==log)
+        c.edges().insert(c.edges().end(),l.edges().begin(),l.edges().end());
+      range = none;
+    };
     for (const auto& x : j) {
       if (x.is_array()) {
-        u = x;
-        uniform = true;
-      } else {
-        if (uniform) {
-          c += u;
-          uniform = false;
+        add_range();
+        if (x.size() && x[0].is_string()) {
+          l = x;
+          range = log;
+        } else {
+          u = x;
+          range = uniform;
         }
+      } else {
+        add_range();
         c.edges().emplace_back(x);
       }
     }
-    if (uniform) {
+    if (range!=none) {
       if (c.nedges()) {
-        c += u;
+        add_range();
       } else {
-        axis = std::move(u);
+        if (range==uniform) axis = std::move(u);
+        else axis = std::move(l);
         return;
       }
     }
     c.sort();
-    axis = std::move(c);
+    if (c.nedges() > max_cont_nedges) axis = lut_axis(c);
+    else axis = std::move(c);
   }
 };
 
@@ -0,0 +1,185 @@
+// ------------------------------------------------------------------
+// Queue of ranges of entries, shared by hist jobs through an SQLite
+// database, e.g. on a shared filesystem.
+//
+// CREATE TABLE work (
+//   id     INTEGER PRIMARY KEY,
+//   grp    TEXT,    -- group of work items processed by the same workers
+//   file   TEXT,    -- input file
+//   first  INTEGER, -- range of entries in the file
+//   last   INTEGER,
+//   worker TEXT,    -- worker holding the lease
+//   lease  REAL,    -- unix time when the lease expires
+//   done   INTEGER  -- 1 when the worker's output was written
+// )
+//
+// A worker claims items one at a time, until there are none left.
+// Items are never returned to the queue once claimed by a worker that is
+// still alive: they stay leased to it, with the leases renewed by a
+// heartbeat thread, until its output is written. Items of workers that
+// die expire and are claimed by others.
+// ------------------------------------------------------------------
+
+#ifndef WORK_QUEUE_HH
+#define WORK_QUEUE_HH
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <unistd.h>
+
+#include "ivanp/sqlite.hh"
+
+class work_queue {
+public:
+  struct item {
+    sqlite3_int64 id;
+    std::string file;
+    sqlite3_int64 first, last;
+  };
+
+private:
+  ivanp::sqlite db;
+  std::string grp, worker;
+  double lease;
+  unsigned nclaimed = 0;
+  bool finished = false;
+
+  std::thread heartbeat;
+  std::mutex mx;
+  std::condition_variable cv;
+  bool stop = false;
+
+  static double now() {
+    using namespace std::chrono;
+    return duration<double>(system_clock::now().time_since_epoch()).count();
+  }
+
+  static void connect(ivanp::sqlite& db, const char* filename) {
+    db = ivanp::sqlite(filename);
+    db.busy_timeout(60'000); // wait for other workers' transactions
+  }
+
+  // number of claimed items still leased to this worker
+  unsigned nowned() {
+    auto& s = db.cached(
+      "SELECT count(*) FROM work WHERE worker=? AND done=0");
+    s.bind(1,worker);
+    s.step();
+    const unsigned n = s.column_int(0);
+    s.reset();
+    return n;
+  }
+
+public:
+  work_queue(const char* filename, std::string grp, double lease = 600)
+  : grp(std::move(grp)), lease(lease) {
+    connect(db,filename);
+    char host[256] { };
+    gethostname(host,sizeof(host)-1);
+    worker = ivanp::cat(host,':',std::to_string(getpid()));
+
+    heartbeat = std::thread([this, filename=std::string(filename)]{
+      ivanp::sqlite db;
+      connect(db,filename.c_str());
+      std::unique_lock lock(mx);
+      while (!cv.wait_for(lock, std::chrono::duration<double>(this->lease/4),
+        [this]{ return stop; }
+      )) {
+        try {
+          auto& s = db.cached(
+            "UPDATE work SET lease=? WHERE worker=? AND done=0");
+          s.bind(1,now()+this->lease);
+          s.bind(2,worker);
+          s.step();
+        } catch (const std::exception& e) {
+          std::cerr << "work_queue heartbeat: " << e.what() << std::endl;
+        }
+      }
+    });
+  }
+  ~work_queue() {
+    { std::lock_guard lock(mx);
+      stop = true;
+    }
+    cv.notify_one();
+    heartbeat.join();
+    if (!finished) try { // give the items back, if the job failed
+      release();
+    } catch (const std::exception& e) {
+      std::cerr << "work_queue: " << e.what() << std::endl;
+    }
+  }
+  work_queue(const work_queue&) = delete;
+  work_queue& operator=(const work_queue&) = delete;
+
+  const std::string& name() const noexcept { return worker; }
+
+  // All files of the group
+  std::vector<std::string> files() {
+    std::vector<std::string> files;
+    auto& s = db.cached(
+      "SELECT DISTINCT file FROM work WHERE grp=? ORDER BY file");
+    s.bind(1,grp);
+    while (s.step()) files.emplace_back(s.column_text(0));
+    return files;
+  }
+
+  // Claim the next available item
+  std::optional<item> claim() {
+    ivanp::sqlite::transaction t(db,"BEGIN IMMEDIATE;");
+    auto& s = db.cached(
+      "SELECT id, file, first, last FROM work"
+      " WHERE grp=? AND done=0 AND (worker IS NULL OR lease<?)"
+      " ORDER BY id LIMIT 1");
+    const double t_now = now();
+    s.bind(1,grp);
+    s.bind(2,t_now);
+    if (!s.step()) return { };
+    item x { s.column_int64(0), s.column_text(1),
+             s.column_int64(2), s.column_int64(3) };
+    s.reset();
+
+    auto& u = db.cached("UPDATE work SET worker=?, lease=? WHERE id=?");
+    u.bind(1,worker);
+    u.bind(2,t_now+lease);
+    u.bind(3,x.id);
+    u.step();
+    t.commit();
+    ++nclaimed;
+    return x;
+  }
+
+  // Whether all claimed items are still leased to this worker.
+  // If not, others may have processed some of them, and this worker's
+  // output must not be written.
+  bool owns_all() { return nowned() == nclaimed; }
+
+  // Mark the claimed items done, after the output was written.
+  // Returns false if some of them were claimed by others in the meantime.
+  bool finish() {
+    ivanp::sqlite::transaction t(db,"BEGIN IMMEDIATE;");
+    if (nowned() != nclaimed) return false;
+    auto& s = db.cached("UPDATE work SET done=1 WHERE worker=? AND done=0");
+    s.bind(1,worker);
+    s.step();
+    t.commit();
+    finished = true;
+    return true;
+  }
+
+  // Return the claimed items to the queue
+  void release() {
+    auto& s = db.cached(
+      "UPDATE work SET worker=NULL, lease=0 WHERE worker=? AND done=0");
+    s.bind(1,worker);
+    s.step();
+  }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+
+import sys, os, sqlite3, json, argparse
+
+argparser = argparse.ArgumentParser(
+    description='Load summaries of hist jobs into the jobs table,'
+                ' used by submit.py to estimate jobs\' time',
+    formatter_class=argparse.ArgumentDefaultsHelpFormatter
+)
+argparser.add_argument('summaries', nargs='+',
+    help='summary JSON files, or directories to search for them')
+argparser.add_argument('-d', type=str, default='../sql/ntuples.db',
+    help='database')
+args = argparser.parse_args()
+
+def conf_key(conf):
+    return None if conf is None else \
+        json.dumps(conf,sort_keys=True,separators=(',',':'))
+
+def find_summaries(paths):
+    for path in paths:
+        if os.path.isdir(path):
+            for d, _, files in os.walk(path):
+                for f in sorted(files):
+                    if f.endswith('.json'):
+                        yield os.path.join(d,f)
+        else:
+            yield path
+
+db = sqlite3.connect(args.d)
+db.executescript('''
+CREATE TABLE IF NOT EXISTS jobs (
+  id INTEGER PRIMARY KEY,
+  summary TEXT,       -- job's summary file
+  dir TEXT,           -- input file's directory
+  file TEXT,          -- input file name (without directory)
+  part TEXT,          -- NLO part, from ntuples
+  njets INTEGER,      -- number of jets, from ntuples
+  jets TEXT,          -- jets definition, JSON with sorted keys
+  reweighting TEXT,   -- reweighting definition, JSON with sorted keys
+  entries INTEGER,    -- entries processed in the file
+  loop REAL,          -- seconds of the event loop spent on the file
+  wall REAL,          -- job's wall time, split between files as the loop
+  cpu REAL,           -- job's CPU time, split in the same way
+  max_rss INTEGER,    -- job's maximum resident set size in kB
+  host TEXT,
+  time REAL,          -- unix time when the job started
+  UNIQUE (summary, dir, file)
+);
+CREATE INDEX IF NOT EXISTS jobs_conf ON jobs (part,njets,jets,reweighting);
+''')
+
+n = 0
+for name in find_summaries(args.summaries):
+    try:
+        with open(name) as f:
+            s = json.load(f)
+        if not isinstance(s,dict) or 'files' not in s: continue
+    except (OSError, ValueError) as e:
+        print(f'{name}: {e}', file=sys.stderr)
+        continue
+
+    summary = os.path.realpath(name)
+    jets = s.get('jets')
+    if jets is not None: # njets_min is selected per job by submit.py
+        jets = { k: v for k, v in jets.items() if k != 'njets_min' }
+    loop = sum(f['wall'] for f in s['files'])
+
+    with db:
+        for f in s['files']:
+            d, file = os.path.split(f['file'])
+            info = db.execute(
+                'SELECT part, njets FROM ntuples WHERE dir=? AND file=?',
+                (d,file)).fetchone() or (None,None)
+            share = f['wall']/loop if loop > 0 else 0
+            db.execute('''
+INSERT OR REPLACE INTO jobs (
+  summary, dir, file, part, njets, jets, reweighting,
+  entries, loop, wall, cpu, max_rss, host, time
+) VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?)
+''', ( summary, d, file, *info, conf_key(jets), conf_key(s.get('reweighting')),
+       f['entries'], f['wall'], s['wall']*share, s['cpu']*share,
+       s.get('max_rss'), s.get('host'), s.get('time') ))
+    n += 1
+
+print(f'{n} summaries loaded into {args.d}')
@@ -1,6 +1,6 @@
 #!/usr/bin/env python3
 
-import sys, os, sqlite3, json, re, argparse, time
+import sys, os, sqlite3, json, re, argparse, time, math
 from subprocess import Popen, PIPE
 from collections import defaultdict
 from itertools import product
@@ -12,16 +12,29 @@ argparser.add_argument('-a', type=str, default='../../bin/hist',
     help='analysis executable')
 argparser.add_argument('-d', type=str, default='.',
     help='base output directory')
+argparser.add_argument('-l', type=int, default=0,
+    help='run jobs locally on this many cores, instead of on condor')
 argparser.add_argument('-m',action='store_true',
     help='add "+IsMediumJob = True" to condor jobs')
-argparser.add_argument('-n', type=int, default=int(25e6),
-    help='maximum number of events per job')
+argparser.add_argument('-n', type=int, default=0,
+    help='maximum number of entries per job, 0 for no limit'
+         ' (was 25M before jobs were sized by -w)')
+argparser.add_argument('-q', type=int, default=0,
+    help='put work in a shared queue, at least this many items per job')
 argparser.add_argument('-r', type=float, default=0.4,
     help='jet radius')
+argparser.add_argument('-s', type=float, default=2.75,
+    help='stop jobs after this many hours, to be resumed, 0 for no limit')
 argparser.add_argument('-t', type=str, default=f'{int(time.time()*1000)}',
     help='set run tag')
+argparser.add_argument('-w', type=float, default=2,
+    help='target wall time per job in hours')
 argparser.add_argument('-x',action='store_true',
     help='generate job scripts but don\'t submit')
+argparser.add_argument('--mem', type=float, default=0,
+    help='with -l, limit of address space (not resident memory) per job in GB')
+argparser.add_argument('--retries', type=int, default=2,
+    help='number of times to rerun a failed or stopped job')
 args = argparser.parse_args()
 print(args)
 
@@ -44,8 +57,57 @@ selection = [{
     'info': ['ED GGFHT pt25.0 eta4.5']
 }]
 
+# added to the runcards if not None
+reweighting = None
+
+jets = {
+    'cuts': { 'pt': 30, 'eta': 4.4 },
+    'algorithm': [ 'antikt', args.r ]
+}
+
 db = sqlite3.connect('../sql/ntuples.db')
 
+def conf_key(conf):
+    return None if conf is None else \
+        json.dumps(conf,sort_keys=True,separators=(',',':'))
+
+class cost_model:
+    '''
+    Estimated wall time per entry, in seconds.
+    Measured throughput of previous jobs is used if it was recorded in the jobs
+    table of ntuples.db for the same part, njets, jets, and reweighting.
+    Otherwise, the estimate is a rough guess.
+    '''
+    # Placeholders, not measurements: to be replaced with per-part costs
+    # from jobs recorded by collect_jobs.py
+    prior = { 'B': 15e-6, 'RS': 25e-6, 'I': 40e-6, 'V': 20e-6 }
+
+    def __init__(self,db):
+        self.measured = { }
+        if db.execute('''
+SELECT 1 FROM sqlite_master WHERE type='table' AND name='jobs'
+''').fetchone() is None: return
+        for *key, entries, wall in db.execute('''
+SELECT part, njets, jets, reweighting, sum(entries), sum(wall)
+FROM jobs
+WHERE entries > 0
+GROUP BY part, njets, jets, reweighting
+'''):
+            self.measured[tuple(key)] = wall/entries
+
+    def __call__(self,part,njets,jets,reweighting):
+        key = ( part, njets, conf_key(jets), conf_key(reweighting) )
+        cost = self.measured.get(key)
+        if cost is not None: return cost
+        cost = self.prior.get(part,max(self.prior.values()))
+        cost *= 1 + 0.5*(njets-1)
+        for rw in (reweighting or [ ]):
+            cost *= 1 + 0.1*len(rw.get('ren_fac',[ ])) \
+                      + (2 if rw.get('pdf_var') else 0)
+        return cost
+
+cost = cost_model(db)
+
 LD_LIBRARY_PATH = os.environ['LD_LIBRARY_PATH']
 
 subcount = defaultdict(lambda:0)
@@ -77,6 +139,7 @@ do_mtop = check_mtop()
 def make_chunks(names,vals):
     print(dict(zip(names,vals)))
     fs = [ ( x[-1], x[0]+'/'+x[1], x[3], x[5],
+        x[-1]*cost(x[4],x[3],jets,reweighting),
         f'{x[2]}{x[3]}j{x[4]}_{x[5]:g}TeV' \
         + ('_'+('mtop' if ('mtop' in x[6]) else 'eft') if do_mtop else '') \
         + ('_'+diagram(x[6]) if do_diag else '') \
@@ -94,19 +157,60 @@ WHERE
         if pref != fs[i][-1]:
             raise Exception(f'Incompatible selections:\n{pref}\n{fs[i][-1]}')
 
+    total = sum(f[4] for f in fs)
+    nchunks = max(
+        math.ceil(total/(args.w*3600)),
+        math.ceil(sum(f[0] for f in fs)/args.n) if args.n > 0 else 1, 1)
+
     chunks = [ ]
-    n = 0
-    for f in fs:
-        if n == 0:
-            subcount[pref] += 1
-            chunks.append(( f'{pref}_{subcount[pref]:0>3d}', [], f[3], f[2] ))
-        chunks[-1][1].append(f[1])
-        n += f[0]
-        if n >= args.n:
-            n = 0
+    for i in range(nchunks):
+        subcount[pref] += 1
+        chunks.append([ f'{pref}_{subcount[pref]:0>3d}', None,
+            fs[0][3], fs[0][2], total/nchunks ])
 
+    if args.q > 0:
+        # the chunks' jobs take work items from the queue
+        for c in chunks:
+            c[1] = { 'queue': { 'db': 'queue.db', 'group': pref } }
+        for part in split(fs,nchunks*args.q):
+            queue_items.extend( (pref,*x) for x, n in part )
+        print(f'{pref}: {nchunks} workers, {nchunks*args.q} work items,'
+              f' estimated {total/nchunks/3600:.2f} hours')
+    else:
+        for c, part in zip(chunks,split(fs,nchunks)):
+            c[1] = { 'files': [
+                x[0] if x[1] == 0 and x[2] == n else x
+                for x, n in part ] }
+            print(f'{c[0]}: {len(part)} files,'
+                  f' estimated {c[4]/3600:.2f} hours')
     return chunks
 
+def split(fs,n):
+    '''
+    Split the files into n parts of equal estimated time.
+    Files are split at entry boundaries, as [ file, first, last ].
+    hist moves these to the events' boundaries.
+    Returns lists of ( [ file, first, last ], entries in the file ).
+    '''
+    total = sum(f[4] for f in fs)
+    parts = [ [ ] for i in range(n) ]
+    t = 0 # time at the start of a file
+    for f in fs:
+        # parts' boundaries falling inside the file
+        first = 0
+        i = min(int(t*n/total),n-1)
+        while True:
+            t_end = (i+1)*total/n
+            last = f[0] if i+1 == n or t_end >= t + f[4] \
+                else round((t_end - t)/f[4]*f[0])
+            if last > first:
+                parts[i].append(( [ f[1], first, last ], f[0] ))
+            if last == f[0]: break
+            first = last
+            i += 1
+        t += f[4]
+    return parts
+
 args.t = args.t.strip()
 if len(args.t)>0:
     args.t = re.sub(r'\s+','-',args.t)
@@ -130,15 +234,18 @@ def make_job(chunk):
 export LD_LIBRARY_PATH={LD_LIBRARY_PATH}\n
 {args.a} - << CARD
 ''' + json.dumps({
-        'input': { 'files': chunk[1] },
+        'input': chunk[1],
         'rootS': chunk[2],
-        'jets': {
-            'cuts': { 'pt': 30, 'eta': 4.4 },
-            'algorithm': [ 'antikt', args.r ],
-            'njets_min': chunk[3]
-        },
+        'jets': { **jets, 'njets_min': chunk[3] },
         'binning': '../binning.json',
-        'output': f'../{out_dir}/{chunk[0]}.root'
+        'output': {
+            'file': f'../{out_dir}/{chunk[0]}.root',
+            'status': f'{chunk[0]}.status',
+            # resumed when the job is rerun
+            **({ 'checkpoint': 1800 } if args.q <= 0 else { })
+        },
+        **({ 'walltime': args.s*3600 } if args.s > 0 else { }),
+        **({ 'reweighting': reweighting } if reweighting else { })
     }, indent=2, separators=(',',': ')) + '\nCARD\n')
 
     os.chmod(script,0o775)
@@ -165,6 +272,8 @@ getenv = True
 '''queue
 ''')
 
+jobs = [ ]
+queue_items = [ ]
 with open('jobs.dag','w') as f:
     n = 0
     for s in selection:
@@ -173,14 +282,77 @@ with open('jobs.dag','w') as f:
             for chunk in make_chunks(keys,vals):
                 print(chunk[0])
                 make_job(chunk)
-                f.write(f'JOB j{n} job.sub\nVARS j{n} name="{chunk[0]}"\n\n')
+                jobs.append(( chunk[0], chunk[4] ))
+                f.write(f'JOB j{n} job.sub\nVARS j{n} name="{chunk[0]}"\n'
+                        f'RETRY j{n} {args.retries}\n\n')
                 n += 1
     f.write('''\
 JOB finish job.sub
 VARS finish name="finish"\n
 PARENT '''+(' '.join(f'j{i}' for i in range(n)))+' CHILD finish\n')
 
+if args.q > 0:
+    # work queue, see include/work_queue.hh
+    if os.path.exists('queue.db'): os.remove('queue.db')
+    with sqlite3.connect('queue.db') as q:
+        q.execute('''
+CREATE TABLE work (
+  id     INTEGER PRIMARY KEY,
+  grp    TEXT,
+  file   TEXT,
+  first  INTEGER,
+  last   INTEGER,
+  worker TEXT,
+  lease  REAL DEFAULT 0,
+  done   INTEGER DEFAULT 0
+)''')
+        q.executemany(
+            'INSERT INTO work (grp,file,first,last) VALUES (?,?,?,?)',
+            queue_items)
+        q.execute('CREATE INDEX work_grp ON work (grp,done)')
+
+def run_local(jobs):
+    '''
+    Run the jobs on a pool of args.l workers, longest estimated first,
+    then the finish script if all of them succeeded.
+    Output is written to the same files as by condor.
+    '''
+    from concurrent.futures import ThreadPoolExecutor
+
+    # preexec_fn is not safe with threads, so the limit is set by the shell
+    def command(name):
+        if args.mem <= 0: return ( './'+name+'.sh', )
+        return ( '/bin/bash', '-c', 'ulimit -v $1 && exec "$0"',
+            './'+name+'.sh', str(int(args.mem*(1<<20))) ) # in KiB
+
+    def run(name):
+        for attempt in range(args.retries+1):
+            with open(name+'.out','w') as out, open(name+'.err','w') as err:
+                status = Popen(command(name),
+                    stdout=out, stderr=err
+                ).wait()
+            if status == 0: return True
+            print(f'{name} failed with status {status}' + (
+                ', retrying' if attempt < args.retries else ''),
+                file=sys.stderr)
+        return False
+
+    jobs = sorted(jobs,key=lambda job: -job[1])
+    t0 = time.time()
+    with ThreadPoolExecutor(max_workers=args.l) as pool:
+        ok = list(pool.map(run,(job[0] for job in jobs)))
+    nfailed = ok.count(False)
+    print(f'{len(jobs)-nfailed} of {len(jobs)} jobs completed'
+          f' in {(time.time()-t0)/3600:.2f} hours')
+    if nfailed:
+        print('Not running finish.sh',file=sys.stderr)
+        sys.exit(1)
+    sys.exit(Popen(('./finish.sh',)).wait())
+
 if not args.x:
-    Popen(f'rm -fv {condor_dir}/jobs.dag*',shell=True).communicate()
-    Popen(('condor_submit_dag','jobs.dag')).communicate()
+    if args.l > 0:
+        run_local(jobs)
+    else:
+        Popen(f'rm -fv {condor_dir}/jobs.dag*',shell=True).communicate()
+        Popen(('condor_submit_dag','jobs.dag')).communicate()
 
@@ -1,5 +1,7 @@
 #include <chrono>
 #include <cmath>
+#include <sstream>
+#include <stdexcept>
 
 #include "Higgs2diphoton.hh"
 
@@ -10,18 +12,20 @@ Higgs2diphoton::Higgs2diphoton(seed_type seed)
   phi_dist(0.,2*M_PI), cts_dist(-1.,1.)
 { }
 
-Higgs2diphoton::photons_type
-Higgs2diphoton::operator()(const vec_t& Higgs, bool new_kin) {
-  if (new_kin) {
-    const double phi = phi_dist(rng);
-    const double cts = cts_dist(rng);
+void Higgs2diphoton::draw() {
+  const double phi = phi_dist(rng);
+  const double cts = cts_dist(rng);
 
-    const double sts = std::sin(std::acos(cts));
-    const double cos_phi = std::cos(phi);
-    const double sin_phi = std::sin(phi);
+  const double sts = std::sin(std::acos(cts));
+  const double cos_phi = std::cos(phi);
+  const double sin_phi = std::sin(phi);
 
-    cm_photon = { cos_phi*sts, sin_phi*sts, cts };
-  }
+  cm_photon = { cos_phi*sts, sin_phi*sts, cts };
+}
+
+Higgs2diphoton::photons_type
+Higgs2diphoton::operator()(const vec_t& Higgs, bool new_kin) {
+  if (new_kin) draw();
 
   const double E = Higgs.m()/2;
   const auto boost = Higgs.boost_vector();
@@ -34,3 +38,14 @@ Higgs2diphoton::operator()(const vec_t& Higgs, bool new_kin) {
     vec4(photon,-E) >> boost
   };
 }
+
+std::string Higgs2diphoton::state() const {
+  std::ostringstream ss;
+  ss << rng;
+  return std::move(ss).str();
+}
+void Higgs2diphoton::state(const std::string& s) {
+  std::istringstream ss(s);
+  ss >> rng;
+  if (!ss) throw std::runtime_error("invalid Higgs2diphoton RNG state");
+}
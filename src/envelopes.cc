@@ -1,18 +1,27 @@
 #include <array>
+#include <vector>
+#include <algorithm>
 #include <tuple>
 #include <map>
 #include <unordered_map>
-#include <regex>
 #include <stdexcept>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+#include <unistd.h>
 
 #include <TFile.h>
 #include <TKey.h>
 #include <TH1.h>
+#include <TH2.h>
 
 #include <LHAPDF/LHAPDF.h>
 
 #include "ivanp/string.hh"
 #include "ivanp/cont/map.hh"
+#include "ivanp/root_output.hh"
+#include "envelopes.hh"
 
 #define STR1(x) #x
 #define STR(x) STR1(x)
@@ -38,9 +47,24 @@ TClass* get_class(const char* name) {
   return classes[class_ptr->GetName()] = class_ptr;
 }
 
-std::unordered_map<std::string,LHAPDF::PDFSet> pdf_sets;
-const LHAPDF::PDFSet* get_pdf_set(const std::string& name) {
-  return &pdf_sets.try_emplace(name,name).first->second;
+using envelopes::get_pdf_envelope;
+using envelopes::parse_weight;
+using envelopes::bins;
+
+// Envelopes are computed after all histograms are read,
+// in parallel, as they only access arrays of bin values
+std::vector<std::function<void()>> jobs;
+
+void run_jobs(unsigned nthreads) {
+  std::atomic<size_t> next = 0;
+  auto worker = [&]{
+    for (size_t i; (i = next++) < jobs.size(); )
+      jobs[i]();
+  };
+  std::vector<std::jthread> threads;
+  for (unsigned t=1; t<nthreads; ++t)
+    threads.emplace_back(worker);
+  worker();
 }
 
 template <typename T>
@@ -59,40 +83,11 @@ T get_obj(TDirectory* dir, const char* name) {
     return dynamic_cast<T&>(*dir->Get(name));
 }
 
-void scale_unc(const std::vector<TH1*>& vars, TH1* u, TH1* d) {
-  const auto n = u->GetNcells();
-  for (TH1* h : vars)
-    for (auto i = n; i--; ) {
-      const auto v = h->GetBinContent(i);
-      if (v > u->GetBinContent(i)) u->SetBinContent(i,v);
-      if (v < d->GetBinContent(i)) d->SetBinContent(i,v);
-    }
-}
-void pdf_unc(
-  const LHAPDF::PDFSet* pdf_set,
-  const std::vector<TH1*>& vars,
-  TH1* u,
-  TH1* d
-) {
-  const auto nbins = u->GetNcells();
-  const auto nvars = vars.size();
-  std::vector<double> values(nvars);
-  LHAPDF::PDFUncertainty unc;
-  for (auto i = nbins; i--; ) {
-    for (auto j = nvars; j--; )
-      values[j] = vars[j]->GetBinContent(i);
-    pdf_set->uncertainty(unc,values);
-    const double v = values[0];
-    u->SetBinContent(i,v+unc.errplus);
-    d->SetBinContent(i,v-unc.errminus);
-  }
-}
-
 void loop_envelopes(
   const std::array<TDirectory*,3>& out,
   TDirectory* nom,
   const std::vector<TDirectory*>& vars,
-  const LHAPDF::PDFSet* pdf_set
+  const envelopes::pdf_envelope* pdf
 ) {
   for (TObject* key : *nom->GetListOfKeys()) {
     const char* const name = key->GetName();
@@ -103,30 +98,35 @@ void loop_envelopes(
         out | [&](TDirectory* d){ return d ? d->mkdir(name) : nullptr; },
         read_key<TDirectory>(key),
         vars | [&](TDirectory* d){ return &get_obj<TDirectory&>(d,name); },
-        pdf_set
+        pdf
       );
     } else if (inherits_from<TH1>(class_ptr)) {
+      // histograms selected with only some of the weights are not varied
+      const auto hvars = vars | [&](TDirectory* d){
+        return get_obj<TH1*>(d,name);
+      };
+      const bool varied =
+        std::find(hvars.begin(),hvars.end(),nullptr) == hvars.end();
       TH1* hs[3];
       TH1* h = read_key<TH1>(key);
       hs[0] = h; // always needed for pdf uncertainties
-      for (unsigned i=(out[0]?0:1); i<3; ++i) {
+      for (unsigned i=(out[0]?0:1), n=(varied?3:1); i<n; ++i) {
         out[i]->cd();
         hs[i] = h = static_cast<TH1*>(h->Clone());
         if (i==1) h->Sumw2(false); // stat. unc. only for nominal
       }
-      if (pdf_set) {
-        const size_t n = vars.size();
-        std::vector<TH1*> pdf_vars(n+1);
-        pdf_vars[0] = hs[0];
-        for (size_t i=0; i<n; ++i)
-          pdf_vars[i+1] = &get_obj<TH1&>(vars[i],name);
-        pdf_unc(pdf_set, pdf_vars, hs[1], hs[2]);
-      } else {
-        scale_unc(
-          vars | [&](TDirectory* d){ return &get_obj<TH1&>(d,name); },
-          hs[1], hs[2]
-        );
-      }
+      if (!varied) continue;
+      std::vector<const double*> xs;
+      if (pdf) xs.push_back(bins(hs[0]));
+      for (TH1* v : hvars) xs.push_back(bins(v));
+      double *u = bins(hs[1]), *d = bins(hs[2]);
+      const size_t n = h->GetNcells();
+      if (pdf) jobs.emplace_back([=,xs=std::move(xs)]{
+        (*pdf)(xs,u,d,n);
+      });
+      else jobs.emplace_back([=,xs=std::move(xs)]{
+        envelopes::scale_envelope(xs,u,d,n);
+      });
     }
   }
 }
@@ -150,41 +150,82 @@ struct variation {
   std::map<int,TDirectory*> pdf;
 };
 
-std::regex r(R"((.*\s)([^\s]+):(\d+) ren:([\d.]+) fac:([\d.]+)(?:\s+(.*))?)");
+// Compact layout ---------------------------------------------------
+// Each histogram is a TH2D with a y bin for every weight and tags
+// combination, labeled as "weight/tag1/tag2".
+// Columns of bins are contiguous in the TH2D arrays.
+
+// Plans are shared by histograms with the same labels
+std::map<std::vector<std::string>,envelopes::column_envelopes> plans;
 
-int main(int argc, char* argv[]) {
-  if (argc!=3) {
-    cout << "usage: " << argv[0] << " input.root output.root\n";
+void compact_envelopes(TH2* h) {
+  const auto labels = envelopes::column_labels(h);
+  const auto& plan = plans.try_emplace(labels,labels,false).first->second;
+  envelopes::compact_envelopes(h,plan,[](auto&& f){
+    jobs.emplace_back(std::move(f));
+  });
+}
+
+int main(int argc, char* argv[]) try {
+  const char* opt_c = "lzma:9";
+  unsigned opt_j = std::max(std::thread::hardware_concurrency(),1u);
+  for (int o; (o = getopt(argc,argv,"c:j:")) != -1; ) {
+    switch (o) {
+      case 'c': opt_c = optarg; break;
+      case 'j': opt_j = std::max(atoi(optarg),1); break;
+      default : return 1;
+    }
+  }
+  if (argc-optind != 2) {
+    cout << "usage: " << argv[0] << " [options ...] input.root output.root\n"
+      "  -c alg[:lvl] output compression: none, zlib, lz4, zstd, or lzma\n"
+      "               (default lzma:9)\n"
+      "  -j N         number of threads computing envelopes\n";
     return 1;
   }
 
   std::map<std::array<std::string,3>,variation> variations;
 
-  TFile fin(argv[1]);
+  TFile fin(argv[optind]);
   if (fin.IsZombie()) return 1;
 
-  TFile fout(argv[2],"recreate");
+  TFile fout(argv[optind+1],"recreate");
   if (fout.IsZombie()) return 1;
-  fout.SetCompressionAlgorithm(ROOT::kLZMA);
-  fout.SetCompressionLevel(9);
+  ivanp::set_compression(fout,opt_c);
+
+  const TObject* layout = fin.Get("layout");
+  if (layout && !strcmp(layout->GetTitle(),"compact")) {
+    fout.cd();
+    for (TObject* key : *fin.GetListOfKeys()) {
+      const char* const name = key->GetName();
+      const char* const class_name = static_cast<TKey*>(key)->GetClassName();
+      TClass* const class_ptr = get_class(class_name);
+      if (inherits_from<TH2>(class_ptr)) {
+        compact_envelopes(read_key<TH2>(key));
+      } else if (strcmp(name,"tags")) {
+        fout.WriteObject(read_key(key),name);
+      }
+    }
+    run_jobs(opt_j);
+    fout.Write(0,TObject::kOverwrite);
+    return 0;
+  }
 
   for (TObject* key : *fin.GetListOfKeys()) {
     const char* const name = key->GetName();
     const char* const class_name = static_cast<TKey*>(key)->GetClassName();
     TClass* const class_ptr = get_class(class_name);
     if (inherits_from<TDirectory>(class_ptr)) {
-      std::cmatch m;
-      if (std::regex_match(name,m,r)) {
-        const int    pdf = std::stoi(m[3]);
-        const double ren = std::stod(m[4]);
-        const double fac = std::stod(m[5]);
-        const bool   nom_pdf   = (pdf == 0),
-                     nom_scale = (ren == 1) && (fac == 1);
-        auto& v = variations[{m.str(1),m.str(2),m.str(6)}];
+      if (const auto wl = parse_weight(name)) {
+        const int    pdf = wl->pdf;
+        const double ren = wl->ren;
+        const double fac = wl->fac;
+        const bool   nom_pdf   = wl->nom_pdf(),
+                     nom_scale = wl->nom_scale();
+        auto& v = variations[wl->lbl];
         TDirectory* dir = read_key<TDirectory>(key);
         if (!nom_pdf && !nom_scale) {
-          cerr << "unexpected variation " << m[2] << ':' << m[3]
-            << " ren:" << m[4] << " fac:" << m[5] << endl;
+          cerr << "unexpected variation " << name << endl;
         } else {
           auto& d = ( nom_pdf && nom_scale
             ? v.nom
@@ -218,8 +259,8 @@ int main(int argc, char* argv[]) {
       );
     }
     if (!v.pdf.empty()) { // PDF variations
-      const auto* pdf_set = get_pdf_set(lbl[1]);
-      cout << pdf_set->description() << endl;
+      const auto* pdf = get_pdf_envelope(lbl[1]);
+      pdf->check_size(v.pdf.size()+1);
       loop_envelopes(
         { v.scale.empty() ? fout.mkdir(name.c_str()) : nullptr,
           fout.mkdir((name+" pdf_up").c_str()),
@@ -227,10 +268,14 @@ int main(int argc, char* argv[]) {
         },
         v.nom,
         v.pdf | [](const auto& x){ return x.second; },
-        pdf_set
+        pdf
       );
     }
   }
 
+  run_jobs(opt_j);
   fout.Write(0,TObject::kOverwrite);
+} catch (const std::exception& e) {
+  cerr << e.what() << endl;
+  return 1;
 }
@@ -0,0 +1,298 @@
+// Generate a synthetic ntuple in the BlackHat format, for benchmarking and
+// testing without access to real ntuples.
+// Events are H + n partons with pT, rapidity, and weight distributions
+// resembling those of GoSam ntuples. They are not physical predictions.
+
+#include <iostream>
+#include <vector>
+#include <array>
+#include <random>
+#include <numbers>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include "ivanp/root_output.hh"
+
+using std::cout;
+using std::cerr;
+
+const char* opt_p = "B";
+unsigned opt_j = 1;
+long opt_n = 100000;
+double opt_M = 0; // MB
+double opt_e = 13; // TeV
+const char* opt_c = "zlib:1";
+const char* opt_t = "t3";
+unsigned long opt_s = 0;
+bool opt_f = false;
+bool opt_N = false;
+#define TOGGLE(x) x = !x
+
+void print_usage(const char* prog) {
+  cout << "usage: " << prog << " [options ...] output.root\n"
+    "  -p part      B, RS, I, or V (default B)\n"
+    "  -j N         number of jets at Born level (default 1)\n"
+    "  -n N         number of entries (default 100000)\n"
+    "  -M MB        instead, write entries until the file reaches this size\n"
+    "  -e TeV       center of mass energy (default 13)\n"
+    "  -c alg[:lvl] compression, none, zlib, lz4, zstd, or lzma"
+    " (default zlib:1)\n"
+    "  -t name      TTree name (default t3)\n"
+    "  -s seed      random seed (default 0)\n"
+    "  -f           write momenta as floats instead of doubles\n"
+    "  -N           add ncount branch\n"
+    "  -h, --help   display this help text and exit\n";
+}
+
+template <typename... T> [[gnu::always_inline]]
+inline auto sq(T... x) { return ((x*x) + ...); }
+
+constexpr double mH = 125., pt_min = 20., y_max = 4.5;
+constexpr unsigned max_particles = 16, nusr_wgts = 18;
+
+// Branches' buffers
+struct entry {
+  Int_t id, nparticle, id1, id2, ncount, nuwgt = nusr_wgts;
+  std::array<Double_t,max_particles> px, py, pz, E;
+  std::array<Float_t,max_particles> fpx, fpy, fpz, fE;
+  std::array<Int_t,max_particles> kf;
+  Double_t alphas, weight, weight2, me_wgt, me_wgt2,
+    x1, x2, x1p, x2p, fac_scale, ren_scale;
+  std::array<Double_t,nusr_wgts> usr_wgts;
+  Char_t alphasPower;
+  Char_t part[2] { };
+};
+
+struct particle { double px, py, pz, E; int kf; };
+
+class generator {
+  std::mt19937_64 rng;
+  std::uniform_real_distribution<double> u{0.,1.};
+  std::normal_distribution<double> gaus{0.,1.};
+  const double sqrtS;
+  const unsigned njets;
+  const char part;
+
+  // Steeply falling pT spectrum above the cut
+  double parton_pt() { return pt_min*std::pow(1.-u(rng),-1./3.); }
+
+  // Gluons and light quarks, Higgs last
+  std::vector<particle> kinematics(unsigned n, int q) {
+    std::vector<particle> ps;
+    double sx = 0, sy = 0;
+    for (unsigned i=0; i<n; ++i) {
+      const double pt = parton_pt(),
+        y = (2*u(rng)-1)*y_max, phi = 2*std::numbers::pi*u(rng);
+      const double px = pt*std::cos(phi), py = pt*std::sin(phi);
+      ps.push_back({ px, py, pt*std::sinh(y), pt*std::cosh(y),
+        (q && i==0) ? q : 21 });
+      sx += px;
+      sy += py;
+    }
+    const double y = std::clamp(gaus(rng)*1.8,-y_max,y_max),
+      mt = std::sqrt(sq(mH,sx,sy));
+    ps.push_back({ -sx, -sy, mt*std::sinh(y), mt*std::cosh(y), 25 });
+    return ps;
+  }
+
+  // Momentum fractions of the incoming partons
+  std::array<double,2> fractions(const std::vector<particle>& ps) const {
+    double E = 0, pz = 0;
+    for (const auto& p : ps) {
+      E += p.E;
+      pz += p.pz;
+    }
+    return { (E+pz)/sqrtS, (E-pz)/sqrtS };
+  }
+
+  // Counterterm kinematics: two partons clustered into one massless parton
+  std::vector<particle> cluster(std::vector<particle> ps) {
+    const unsigned np = ps.size()-1;
+    const unsigned i = u(rng)*np, j = (i+1+unsigned(u(rng)*(np-1)))%np;
+    auto& a = ps[std::min(i,j)];
+    const auto& b = ps[std::max(i,j)];
+    a.px += b.px;
+    a.py += b.py;
+    a.pz += b.pz;
+    a.E = std::sqrt(sq(a.px,a.py,a.pz));
+    if (b.kf != 21) a.kf = b.kf;
+    ps.erase(ps.begin()+std::max(i,j));
+    return ps;
+  }
+
+  void fill(entry& e, const std::vector<particle>& ps, double w) {
+    e.nparticle = ps.size();
+    double HT = 0;
+    for (unsigned i=0; i<ps.size(); ++i) {
+      const auto& p = ps[i];
+      e.fpx[i] = e.px[i] = p.px;
+      e.fpy[i] = e.py[i] = p.py;
+      e.fpz[i] = e.pz[i] = p.pz;
+      e.fE [i] = e.E [i] = p.E;
+      e.kf[i] = p.kf;
+      HT += std::sqrt(p.kf==25 ? sq(p.E)-sq(p.pz) : sq(p.px,p.py));
+    }
+    const auto [x1,x2] = fractions(ps);
+    e.x1 = x1;
+    e.x2 = x2;
+    e.x1p = x1 + (1-x1)*u(rng);
+    e.x2p = x2 + (1-x2)*u(rng);
+    e.fac_scale = e.ren_scale = 0.5*HT; // HT1 scale
+    // one loop running from mZ
+    e.alphas = 0.118/(1 + 0.118*7/(2*std::numbers::pi)
+      * std::log(sq(e.ren_scale/91.1876)));
+    // parton luminosity
+    const auto f = [](double x){ return std::pow(x,-1.2)*std::pow(1-x,5); };
+    e.me_wgt2 = w;
+    e.me_wgt = part=='V' ? w*(1 + 0.2*gaus(rng)) : w;
+    e.weight = e.weight2 = w*f(x1)*f(x2);
+
+    e.usr_wgts.fill(0);
+    if (part=='V') {
+      e.usr_wgts[0] = 0.3*w*gaus(rng);
+      e.usr_wgts[1] = 0.1*w*gaus(rng);
+    } else if (part=='I') {
+      for (unsigned i=2; i<nusr_wgts; ++i)
+        e.usr_wgts[i] = 0.1*w*gaus(rng);
+    }
+  }
+
+public:
+  generator(unsigned long seed, double sqrtS, unsigned njets, char part)
+  : rng(seed), sqrtS(sqrtS), njets(njets), part(part) { }
+
+  // Entries of the next event
+  // RS events have a real emission entry, followed by counterterms
+  template <typename F>
+  void event(entry& e, F&& write) {
+    const double r = u(rng); // initial state: gg, gq, or qq
+    const int q = (1 + int(u(rng)*4)) * (u(rng) < 0.5 ? 1 : -1);
+    e.id1 = r < 0.95 ? 21 : q;
+    e.id2 = r < 0.6 ? 21 : (r < 0.95 ? q : -q);
+    if (u(rng) < 0.5) std::swap(e.id1,e.id2);
+    // a quark in the initial state goes to the final state
+    const int qf = (e.id1==21) == (e.id2==21) ? 0 : q;
+
+    const bool real = part=='R';
+    std::vector<particle> ps;
+    do ps = kinematics(njets+real, qf);
+    while (std::ranges::any_of(fractions(ps),[](double x){ return x >= 1; }));
+
+    const double w = std::exp(gaus(rng)) * 1e-3
+      * (part=='I' || part=='V' ? (u(rng) < 0.3 ? -1 : 1) : 1);
+    fill(e,ps,w);
+    write();
+    if (real) {
+      // counterterms partially cancel the real emission
+      for (unsigned i=0, n=1+u(rng)*3; i<n && njets; ++i) {
+        fill(e,cluster(ps),-w*(0.5+0.5*u(rng))/n);
+        write();
+      }
+    }
+    ++e.id;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  for (int o; (o = getopt(argc,argv,"hp:j:n:M:e:c:t:s:fN")) != -1; ) {
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      case 'p': opt_p = optarg; break;
+      case 'j': opt_j = atoi(optarg); break;
+      case 'n': opt_n = atol(optarg); break;
+      case 'M': opt_M = atof(optarg); break;
+      case 'e': opt_e = atof(optarg); break;
+      case 'c': opt_c = optarg; break;
+      case 't': opt_t = optarg; break;
+      case 's': opt_s = strtoul(optarg,nullptr,10); break;
+      case 'f': TOGGLE(opt_f); break;
+      case 'N': TOGGLE(opt_N); break;
+      default : return 1;
+    }
+  }
+  if (argc-optind != 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  const std::string_view part = opt_p;
+  if (!(part=="B" || part=="RS" || part=="I" || part=="V")) {
+    cerr << "part must be B, RS, I, or V\n";
+    return 1;
+  }
+  if (opt_j+2 > max_particles) {
+    cerr << "too many jets\n";
+    return 1;
+  }
+
+  TFile fout(argv[optind],"recreate");
+  if (fout.IsZombie()) return 1;
+  ivanp::set_compression(fout,opt_c);
+  TTree* tree = new TTree(opt_t,"");
+
+  entry e { };
+  e.part[0] = part[0];
+  e.alphasPower = opt_j + 2 + (part!="B");
+
+  tree->Branch("id",&e.id,"id/I");
+  tree->Branch("nparticle",&e.nparticle,"nparticle/I");
+  if (opt_f) {
+    tree->Branch("px",e.fpx.data(),"px[nparticle]/F");
+    tree->Branch("py",e.fpy.data(),"py[nparticle]/F");
+    tree->Branch("pz",e.fpz.data(),"pz[nparticle]/F");
+    tree->Branch("E" ,e.fE .data(),"E[nparticle]/F" );
+  } else {
+    tree->Branch("px",e.px.data(),"px[nparticle]/D");
+    tree->Branch("py",e.py.data(),"py[nparticle]/D");
+    tree->Branch("pz",e.pz.data(),"pz[nparticle]/D");
+    tree->Branch("E" ,e.E .data(),"E[nparticle]/D" );
+  }
+  tree->Branch("alphas",&e.alphas,"alphas/D");
+  tree->Branch("kf",e.kf.data(),"kf[nparticle]/I");
+  tree->Branch("weight",&e.weight,"weight/D");
+  tree->Branch("weight2",&e.weight2,"weight2/D");
+  tree->Branch("me_wgt",&e.me_wgt,"me_wtg/D");
+  tree->Branch("me_wgt2",&e.me_wgt2,"me_wtg2/D");
+  tree->Branch("x1",&e.x1,"x1/D");
+  tree->Branch("x2",&e.x2,"x2/D");
+  tree->Branch("x1p",&e.x1p,"x1p/D");
+  tree->Branch("x2p",&e.x2p,"x2p/D");
+  tree->Branch("id1",&e.id1,"id1/I");
+  tree->Branch("id2",&e.id2,"id2/I");
+  tree->Branch("fac_scale",&e.fac_scale,"fac_scale/D");
+  tree->Branch("ren_scale",&e.ren_scale,"ren_scale/D");
+  tree->Branch("nuwgt",&e.nuwgt,"nuwgt/I");
+  tree->Branch("usr_wgts",e.usr_wgts.data(),"usr_wgts[nuwgt]/D");
+  tree->Branch("alphasPower",&e.alphasPower,"alphasPower/B");
+  tree->Branch("part",e.part,"part[2]/C");
+  if (opt_N) tree->Branch("ncount",&e.ncount,"ncount/I");
+
+  generator gen(opt_s, opt_e*1e3, opt_j, part[0]);
+  std::uniform_int_distribution<int> ncount(1,3);
+  std::mt19937 rng(opt_s);
+  const double max_bytes = opt_M*(1<<20);
+  long n = 0;
+  for (;;) {
+    if (max_bytes > 0 ? fout.GetBytesWritten() >= max_bytes : n >= opt_n)
+      break;
+    e.ncount = ncount(rng);
+    gen.event(e,[&]{ tree->Fill(); ++n; });
+  }
+
+  fout.Write(0,TObject::kOverwrite);
+  cout << argv[optind] << ": " << n << " entries, " << e.id << " events\n";
+}
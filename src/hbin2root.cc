@@ -0,0 +1,143 @@
+// Convert histograms from the native binary format, see hbin.hh,
+// to a ROOT file with either the dirs or the compact layout
+
+#include <iostream>
+#include <vector>
+#include <map>
+
+#include <unistd.h>
+
+#include <TFile.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TNamed.h>
+
+#include "hbin.hh"
+#include "ivanp/root_output.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using ivanp::cat;
+
+bool opt_c = false;
+const char* opt_z = "lzma:9";
+#define TOGGLE(x) x = !x
+
+void print_usage(const char* prog) {
+  cout << "usage: " << prog << " [options ...] input.hbin output.root\n"
+    "  -c           write compact layout, with a TH2D per histogram\n"
+    "  -z alg[:lvl] output compression: none, zlib, lz4, zstd, or lzma\n"
+    "               (default lzma:9)\n"
+    "  -h, --help   display this help text and exit\n";
+}
+
+template <typename H, typename... Y>
+H* make_root_hist(const char* name, const nlohmann::json& axis, Y... y) {
+  if (axis.contains("edges")) {
+    const auto edges = axis["edges"].get<std::vector<double>>();
+    return new H(name,"",edges.size()-1,edges.data(),y...);
+  } else {
+    return new H(name,"",axis.at("ndiv").get<int>(),
+      axis.at("min").get<double>(), axis.at("max").get<double>(), y...);
+  }
+}
+
+// Get a directory by path, creating it if necessary
+TDirectory* get_dir(TDirectory* top, const std::string& path) {
+  static std::map<std::string,TDirectory*> dirs;
+  auto [it,inserted] = dirs.try_emplace(path);
+  if (inserted) {
+    const auto slash = path.rfind('/');
+    TDirectory* parent = slash==std::string::npos
+      ? top : get_dir(top,path.substr(0,slash));
+    it->second = parent->mkdir(path.c_str()+(slash+1));
+  }
+  return it->second;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  for (int o; (o = getopt(argc,argv,"hcz:")) != -1; ) { // short options
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      case 'c': TOGGLE(opt_c); break;
+      case 'z': opt_z = optarg; break;
+      default : return 1;
+    }
+  }
+  if (argc-optind != 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  cout << "input: " << argv[optind] << endl;
+  const hbin::file fin(argv[optind]);
+  const auto& header = fin.header();
+  const double* data = fin.data();
+
+  cout << "output: " << argv[optind+1] << endl;
+  TFile fout(argv[optind+1],"recreate");
+  if (fout.IsZombie()) return 1;
+  ivanp::set_compression(fout,opt_z);
+
+  for (const auto& h : header.at("hists")) {
+    const auto& name = h.at("name").get_ref<const std::string&>();
+    const auto& axis = h.at("axis");
+    const auto& labels = h.at("labels");
+    const unsigned ny = labels.size();
+    const double* w = data + h.at("offset").get<size_t>();
+
+    if (opt_c) {
+      fout.cd();
+      TH2D* h = make_root_hist<TH2D>(name.c_str(),axis,ny,0,ny);
+      TAxis* ya = h->GetYaxis();
+      for (unsigned j=0; j<ny; ++j)
+        ya->SetBinLabel(j+1,labels[j].get_ref<const std::string&>().c_str());
+      h->Sumw2(true);
+      const unsigned nx2 = h->GetNbinsX()+2;
+      const double* w2 = w + ny*nx2;
+      // skip the y underflow row
+      std::copy(w , w +ny*nx2, h->GetArray()+nx2);
+      std::copy(w2, w2+ny*nx2, h->GetSumw2()->GetArray()+nx2);
+    } else {
+      for (unsigned j=0; j<ny; ++j) {
+        get_dir(&fout,labels[j].get_ref<const std::string&>())->cd();
+        TH1D* h = make_root_hist<TH1D>(name.c_str(),axis);
+        h->Sumw2(true);
+        const unsigned nx2 = h->GetNbinsX()+2;
+        const double* wj = w + j*nx2;
+        std::copy(wj, wj+nx2, h->GetArray());
+        std::copy(wj+ny*nx2, wj+(ny+1)*nx2, h->GetSumw2()->GetArray());
+      }
+    }
+  }
+
+  fout.cd();
+  { TH1D* N = new TH1D("N","",4,0,4);
+    TAxis* a = N->GetXaxis();
+    const auto& labels = header.at("N").at("labels");
+    const double* n = data + header.at("N").at("offset").get<size_t>();
+    for (unsigned i=0; i<labels.size(); ++i) {
+      a->SetBinLabel(i+1,labels[i].get_ref<const std::string&>().c_str());
+      N->SetBinContent(i+1,n[i]);
+    }
+  }
+  TNamed("tags",
+    header.at("tags").get_ref<const std::string&>().c_str()).Write();
+  if (opt_c) TNamed("layout","compact").Write();
+
+  fout.Write(0,TObject::kOverwrite);
+}
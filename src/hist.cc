@@ -2,15 +2,24 @@
 #include <iomanip>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <memory>
 #include <optional>
 #include <algorithm>
 #include <functional>
 #include <regex>
+#include <atomic>
+#include <csignal>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+#include <deque>
 
 #include <TFile.h>
 #include <TKey.h>
 #include <TChain.h>
 #include <TH1.h>
+#include <TH2.h>
 
 #include <fastjet/ClusterSequence.hh>
 
@@ -22,11 +31,21 @@
 #include "json/reweighter.hh"
 #include "json/fastjet.hh"
 #include "ivanp/tcnt.hh"
+#include "ivanp/prof.hh"
 #include "ivanp/hist/histograms.hh"
+#include "ivanp/fast_axes.hh"
+#include "hist_bins.hh"
 #include "json/binning.hh"
 #include "ivanp/vec4.hh"
 #include "Higgs2diphoton.hh"
 #include "ivanp/ycombinator.hh"
+#include "hbin.hh"
+#include "ivanp/root_output.hh"
+#include "envelopes.hh"
+#include "work_queue.hh"
+#include "job_stats.hh"
+#include "ivanp/hash.hh"
+#include "entry_index.hh"
 
 #define STR1(x) #x
 #define STR(x) STR1(x)
@@ -44,6 +63,7 @@ using ivanp::vec4;
 using ivanp::branch_reader;
 
 using namespace ivanp::cont::ops::map;
+using namespace ivanp::hist;
 
 json read_json(const char* filename) {
   try {
@@ -78,115 +98,6 @@ T get_val(T val, const json& j, const Ts&... keys) {
   }
 }
 
-// Global event variables
-std::vector<double> weights; // multiple weights per event
-int event_id = -1;
-
-struct initial_state {
-  static constexpr const char* name = "initial_state";
-  static constexpr std::array<const char*,4> tags {
-    "all", "gg", "gq", "qq"
-  };
-  inline static unsigned index;
-  static void set(int id1, int id2) noexcept {
-    const bool g1 = (id1 == 21), g2 = (id2 == 21);
-    index = ( g1!=g2 ? 2 : ( g1 ? 1 : 3 ) );
-  }
-};
-template <typename Bin>
-struct initial_state_tag: initial_state {
-  std::array<Bin,tags.size()> bins;
-  void operator+=(double w) noexcept {
-    bins[0] += w;
-    bins[index] += w;
-  }
-  void finalize() noexcept {
-    for (auto& bin : bins)
-      bin.finalize();
-  }
-  const Bin& operator[](size_t i) const noexcept { return bins[i]; }
-};
-
-struct photon_cuts {
-  static constexpr const char* name = "photon_cuts";
-  static constexpr std::array<const char*,2> tags {
-    "all", "photons_pass"
-  };
-  inline static bool pass;
-  static void set(bool _pass) noexcept {
-    pass = _pass;
-  }
-};
-template <typename Bin>
-struct photon_cuts_tag: photon_cuts {
-  std::array<Bin,tags.size()> bins;
-  void operator+=(double w) noexcept {
-    bins[0] += w;
-    if (pass) bins[1] += w;
-  }
-  void finalize() noexcept {
-    for (auto& bin : bins)
-      bin.finalize();
-  }
-  const Bin& operator[](size_t i) const noexcept { return bins[i]; }
-};
-
-struct multiweight {
-  static constexpr const char* name = "weight";
-  inline static std::vector<std::string> tags;
-};
-template <typename Bin>
-struct multiweight_tag: multiweight { // handle multiple weights
-  std::vector<Bin> bins;
-
-  multiweight_tag(): bins(weights.size()) { }
-  void operator++() noexcept {
-    for (size_t i = weights.size(); i--; )
-      bins[i] += weights[i];
-  }
-  void finalize() noexcept {
-    for (auto& bin : bins)
-      bin.finalize();
-  }
-  const Bin& operator[](size_t i) const noexcept { return bins[i]; }
-};
-
-struct basic_bin_t { // handle NLO MC multiple entries per event
-  double w=0, w2=0, sumw=0;
-  int prev_id = -1;
-  void operator+=(double weight) noexcept {
-    if (prev_id != event_id) {
-      w += sumw;
-      w2 += sumw*sumw;
-      sumw = weight;
-      prev_id = event_id;
-    } else {
-      sumw += weight;
-    }
-  }
-  void finalize() noexcept {
-    w += sumw;
-    w2 += sumw*sumw;
-    sumw = 0;
-    prev_id = -1;
-  }
-};
-
-using namespace ivanp::hist;
-using axis_t = variant_axis< uniform_axis<>, cont_axis<> >;
-using axes_t = std::vector<std::vector< axis_t >>;
-using bin_t = // ***** define bin type *****
-  multiweight_tag<
-  initial_state_tag<
-  photon_cuts_tag<
-    basic_bin_t
-  >>>;
-using hist_t = histogram<
-  bin_t,
-  axes_spec< const axes_t& >,
-  flags_spec< hist_flags::perbin_axes >
->;
-
 template <typename T, bool FirstTag = true>
 void save_tags_impl(std::stringstream& ss) {
   if constexpr (!FirstTag) ss << ',';
@@ -204,34 +115,377 @@ void save_tags_impl(std::stringstream& ss) {
   if constexpr (!std::is_same_v<type,basic_bin_t>)
     save_tags_impl<type,false>(ss);
 }
-void save_tags() {
+std::string tags_json() {
   std::stringstream ss;
   ss << '[';
-  save_tags_impl<bin_t>(ss);
+  save_tags_impl<tags_t<>>(ss);
   ss << ']';
-  TNamed("tags",ss.str().c_str()).Write();
+  return std::move(ss).str();
 }
 
 TH1D* make_root_hist(const char* name, const uniform_axis<>& ax) {
   return new TH1D(name,"",ax.ndiv(),ax.min(),ax.max());
 }
-TH1D* make_root_hist(const char* name, const cont_axis<>& ax) {
+TH1D* make_root_hist(const char* name, const auto& ax)
+requires requires { ax.edges().data(); } {
   return new TH1D(name,"",ax.ndiv(),ax.edges().data());
 }
 
+TH2D* make_root_hist(const char* name, const uniform_axis<>& ax, unsigned ny) {
+  return new TH2D(name,"",ax.ndiv(),ax.min(),ax.max(),ny,0,ny);
+}
+TH2D* make_root_hist(const char* name, const auto& ax, unsigned ny)
+requires requires { ax.edges().data(); } {
+  return new TH2D(name,"",ax.ndiv(),ax.edges().data(),ny,0,ny);
+}
+
+// Paths through the tags tree to all basic bins carried by a bin,
+// and their labels of the form "weight/initial_state/photon_cuts"
+template <typename T>
+void tag_paths(
+  const T& bin,
+  std::vector<std::vector<unsigned>>& paths,
+  std::vector<std::string>& labels,
+  std::vector<unsigned> path = { },
+  const std::string& label = { }
+) {
+  if constexpr (std::is_same_v<T,basic_bin_t>) {
+    paths.emplace_back(std::move(path));
+    labels.emplace_back(label);
+  } else {
+    path.push_back(0);
+    for (unsigned i=0, n=T::tags.size(); i<n; ++i) {
+      const auto* b = bin.find(i);
+      if (!b) continue;
+      path.back() = i;
+      tag_paths(*b, paths, labels, path,
+        label.empty() ? cat(T::tags[i]) : cat(label,'/',T::tags[i]));
+    }
+  }
+}
+template <typename T>
+const basic_bin_t& find_leaf(const T& bin, const unsigned* path) noexcept {
+  if constexpr (std::is_same_v<T,basic_bin_t>) return bin;
+  else return find_leaf(*bin.find(*path),path+1);
+}
+
 std::string bin_str(const auto& axis, unsigned i) {
   std::stringstream ss;
   ss << "_[" << axis.lower(i) << ',' << axis.upper(i) << ')';
   return std::move(ss).str();
 }
 
+// Loop over bins of a histogram in the order of 1D slices along the last
+// dimension. Call slice(name,axis) at the start of every slice, and
+// fill(bin) for every bin, including underflow and overflow.
+template <typename Hist, typename Slice, typename Fill>
+void loop_slices(const char* name, const Hist& h, Slice&& slice, Fill&& fill) {
+  const auto& axes = h.axes();
+  const unsigned ndim = axes.size(), ndim1 = ndim ? ndim-1 : 0;
+  struct indices {
+    unsigned
+       i = 0, // bin index in the axes
+      ni = 0, // number of bins in current axis
+       a = 0, // axis index in this dimension
+      na = 0; // number of axes in this dimension
+  };
+  std::vector<indices> ii(ndim);
+  for (unsigned d=ndim; d--; )
+    ii[d].na = axes[d].size();
+  std::vector<std::string> bins_names(ndim1);
+
+  for (auto bin_it = h.bins().begin();;) { // bin loop
+    for (unsigned d=ndim1; ; ) { // label bins
+      if (d!=0 && ii[d].i==0) {
+        auto& [i,ni,a,na] = ii[--d];
+        bins_names[d] = bin_str(axes[d][a],i);
+      } else break;
+    }
+    for (unsigned d=ndim; d--; ) { // increment indices
+      auto& [i,ni,a,na] = ii[d];
+      if (i==0) {
+        const auto& axis = axes[d][a];
+        ni = axis.nbins();
+        if (d==ndim1) {
+          size_t len = strlen(name);
+          for (const auto& s : bins_names)
+            len += s.size();
+          std::string name2;
+          name2.reserve(len);
+          name2 += name;
+          for (const auto& s : bins_names)
+            name2 += s;
+
+          slice(name2.c_str(),axis);
+        }
+      }
+      if ((++i)>=ni) { // carry over
+        i = 0;
+        if (d) { // next axis
+          if (a+1 < na) ++a;
+        } else return;
+      } else break;
+    }
+
+    fill(*bin_it++);
+  }
+}
+
+json axis_json(const uniform_axis<>& ax) {
+  return { {"min",ax.min()}, {"max",ax.max()}, {"ndiv",ax.ndiv()} };
+}
+json axis_json(const auto& ax) requires requires { ax.edges(); } {
+  return { {"edges",ax.edges()} };
+}
+
+// Write histograms in the native binary format, described in hbin.hh
+void write_native(
+  const char* filename,
+  const auto& hists,
+  const std::array<double,4>& N
+) {
+  json header {
+    { "tags", tags_json() },
+    { "N", {
+      { "offset", 0 },
+      { "labels", { "scale", "count", "events", "entries" } }
+    }}
+  };
+  auto& hs = header["hists"] = json::array();
+  std::vector<double> data(N.begin(),N.end());
+
+  for (const auto& [name,hist] : hists) hist.visit([&](const auto& h){
+    const auto empty = empty_cell(h,hist.sel());
+    std::vector<std::vector<unsigned>> paths;
+    std::vector<std::string> labels;
+    tag_paths(empty,paths,labels);
+    const unsigned ny = paths.size();
+    size_t offset, nx2, ix;
+    loop_slices(name, h,
+      [&](const char* name, const axis_t& axis){ // new data block
+        offset = data.size();
+        nx2 = axis.nbins();
+        ix = 0;
+        hs.push_back({
+          { "name", name },
+          { "axis", std::visit([](const auto& ax){
+              return axis_json(ax);
+            },*axis) },
+          { "labels", labels },
+          { "offset", offset }
+        });
+        data.resize(offset + 2*ny*nx2);
+      },
+      [&](const auto& b){ // fill a column of the data block
+        const auto* filled = b.get_if();
+        const auto& bin = filled ? *filled : empty;
+        double* w = data.data() + offset + ix;
+        for (unsigned j=0; j<ny; ++j) {
+          const auto& leaf = find_leaf(bin,paths[j].data());
+          w[ j    *nx2] = leaf.w;
+          w[(j+ny)*nx2] = leaf.w2;
+        }
+        ++ix;
+      }
+    );
+  });
+
+  header["size"] = data.size();
+  hbin::write(filename,header,data.data(),data.size());
+}
+
+// Checkpoints ------------------------------------------------------
+// State of the histograms at an event boundary, from which an interrupted
+// job is resumed. Uses the container of the native format (hbin.hh) with
+// the job's state in the header, and finalized bins in the data: for every
+// bin of every histogram, 1 if it is allocated and 0 otherwise, followed,
+// if allocated, by w and w2 of all its leaf bins.
+// Only readable by the same program with the same configuration.
+
+template <typename T, typename F>
+void for_leaves(T& bin, F&& f) {
+  if constexpr (std::is_same_v<std::remove_const_t<T>,basic_bin_t>) f(bin);
+  else for (auto& b : bin.bins) for_leaves(b,f);
+}
+
+void write_checkpoint(
+  const std::string& filename, const auto& hists, json state
+) {
+  std::vector<double> data;
+  for (const auto& [name,hist] : hists) hist.visit([&](const auto& h){
+    for (const auto& b : h) {
+      const auto* bin = b.get_if();
+      data.push_back(bin ? 1 : 0);
+      if (bin) for_leaves(*bin,[&](const basic_bin_t& leaf){
+        data.push_back(leaf.w);
+        data.push_back(leaf.w2);
+      });
+    }
+  });
+  const json header {
+    { "checkpoint", std::move(state) },
+    { "size", data.size() }
+  };
+  // replace the previous checkpoint only when the new one is complete
+  const std::string tmp = filename + ".tmp";
+  hbin::write(tmp.c_str(),header,data.data(),data.size());
+  if (std::rename(tmp.c_str(),filename.c_str()))
+    throw std::runtime_error(cat("cannot rename ",tmp," to ",filename));
+}
+
+// Returns the job's state, and adds the saved bins to the histograms
+json read_checkpoint(const std::string& filename, auto& hists) {
+  const hbin::file f(filename.c_str());
+  json state = f.header().at("checkpoint");
+  const double *data = f.data(), *end = data + f.size();
+  auto next = [&]{
+    if (data == end) throw std::runtime_error(cat(
+      "checkpoint ",filename," does not match the histograms"));
+    return *data++;
+  };
+  for (auto& [name,hist] : hists) hist.visit([&](auto& h){
+    for (auto&& b : h) {
+      if (!next()) continue;
+      for_leaves(b.get(),[&](basic_bin_t& leaf){
+        leaf.w  += next();
+        leaf.w2 += next();
+      });
+    }
+  });
+  if (data != end) throw std::runtime_error(cat(
+    "checkpoint ",filename," does not match the histograms"));
+  return state;
+}
+
+// Write envelopes of scale and PDF variations, in place of the variations,
+// with the same naming as the envelopes program.
+// Only meaningful for outputs that are not going to be merged.
+void write_envelopes(
+  ivanp::background_writer& write,
+  const auto& hists,
+  bool compact, bool keep_vars
+) {
+  std::map<const hist_tags*,envelopes::column_envelopes> plans;
+  for (const auto& [name,hist] : hists) hist.visit([&](const auto& h){
+    const auto* sel = &hist.sel();
+    const auto empty = empty_cell(h,*sel);
+    std::vector<std::vector<unsigned>> paths;
+    std::vector<std::string> labels;
+    tag_paths(empty,paths,labels);
+    const unsigned ny = paths.size();
+    const auto& plan = plans.try_emplace(sel,labels,keep_vars).first->second;
+    const auto& out_labels = plan.labels();
+    const unsigned nk = out_labels.size();
+
+    // columns of bins of the current slice
+    std::vector<double> w, w2, ow;
+    std::vector<const double*> in(ny);
+    std::vector<double*> out(nk);
+    unsigned nx2 = 0, ix = 0;
+    std::string slice_name;
+    const axis_t* slice_axis = nullptr;
+
+    auto write_slice = [&]{
+      if (!slice_axis) return;
+      ow.assign(nk*nx2,0.);
+      for (unsigned j=0; j<ny; ++j) in[j] = w.data() + j*nx2;
+      for (unsigned k=0; k<nk; ++k) out[k] = ow.data() + k*nx2;
+      plan(in.data(),out.data(),nx2);
+
+      // stat. unc. only for copied columns
+      if (compact) {
+        TH2D* h2 = std::visit([&](const auto& ax){
+          return make_root_hist(slice_name.c_str(),ax,nk);
+        },**slice_axis);
+        TAxis* ya = h2->GetYaxis();
+        h2->Sumw2(true);
+        double* a  = h2->GetArray();
+        double* a2 = h2->GetSumw2()->GetArray();
+        for (unsigned k=0; k<nk; ++k) {
+          ya->SetBinLabel(k+1,out_labels[k].c_str());
+          std::copy(out[k], out[k]+nx2, a+(k+1)*nx2);
+          if (const int j = plan.source(k); j >= 0)
+            std::copy(w2.data()+j*nx2, w2.data()+(j+1)*nx2, a2+(k+1)*nx2);
+        }
+        write({},h2);
+      } else {
+        for (unsigned k=0; k<nk; ++k) {
+          TH1D* h1 = std::visit([&](const auto& ax){
+            return make_root_hist(slice_name.c_str(),ax);
+          },**slice_axis);
+          std::copy(out[k], out[k]+nx2, h1->GetArray());
+          if (const int j = plan.source(k); j >= 0) {
+            h1->Sumw2(true);
+            std::copy(w2.data()+j*nx2, w2.data()+(j+1)*nx2,
+              h1->GetSumw2()->GetArray());
+          }
+          write(out_labels[k],h1);
+        }
+      }
+    };
+
+    loop_slices(name, h,
+      [&](const char* name, const axis_t& axis){ // new slice
+        write_slice();
+        slice_name = name;
+        slice_axis = &axis;
+        nx2 = axis.nbins();
+        ix = 0;
+        w .assign(ny*nx2,0.);
+        w2.assign(ny*nx2,0.);
+      },
+      [&](const auto& b){ // fill a bin of every column
+        const auto* filled = b.get_if();
+        const auto& bin = filled ? *filled : empty;
+        for (unsigned j=0; j<ny; ++j) {
+          const auto& leaf = find_leaf(bin,paths[j].data());
+          w [j*nx2+ix] = leaf.w;
+          w2[j*nx2+ix] = leaf.w2;
+        }
+        ++ix;
+      }
+    );
+    write_slice();
+  });
+  if (compact) write({},new TNamed("layout","compact"));
+}
+
 // ------------------------------------------------------------------
 
+// First entry of an event at or after entry i of the tree.
+// Entries of the same event are consecutive and have the same id.
+Long64_t event_boundary(TTree* tree, Long64_t i) {
+  const Long64_t n = tree->GetEntries();
+  if (i <= 0) return 0;
+  if (i >= n) return n;
+  TBranch* b = tree->GetBranch("id");
+  int id, prev;
+  b->SetAddress(&prev);
+  b->GetEntry(i-1);
+  b->SetAddress(&id);
+  for (; i<n; ++i) {
+    b->GetEntry(i);
+    if (id != prev) break;
+  }
+  b->ResetAddress();
+  return i;
+}
+
+// Set on SIGTERM, or when the walltime is reached.
+// The event loop then stops at the next event boundary.
+std::atomic<bool> stop_requested = false;
+extern "C" void request_stop(int) {
+  stop_requested = true;
+  std::signal(SIGTERM,SIG_DFL); // a second SIGTERM kills the job
+}
+
 bool photon_eta_cut(double abs_eta) noexcept {
   return (1.37 < abs_eta && abs_eta < 1.52) || (2.37 < abs_eta);
 }
 
 int main(int argc, char* argv[]) {
+  job_stats stats; // timing for the job's summary
+
   if (argc < 2) {
     cout << "usage: " << argv[0] << " config.json [input.root]\n";
     return 1;
@@ -242,6 +496,90 @@ int main(int argc, char* argv[]) {
     : json::parse(std::cin);
   cout << conf/*.dump(2)*/ <<'\n'<< endl;
 
+  const auto& out_conf = get(conf,"output");
+  const auto& out_name =
+    out_conf.is_string() ? get_str(out_conf) : get_str(out_conf,"file");
+  // output name without the .root extension
+  const std::string out_base = out_name.ends_with(".root")
+    ? out_name.substr(0,out_name.size()-5) : out_name;
+
+  PROF_INIT(out_base+".prof.json") // if compiled with IVANP_PROF
+
+  // Stop cleanly on SIGTERM, or after "walltime" seconds, writing output
+  // for the processed entries. Write checkpoints every "checkpoint" seconds
+  // of the output config, and when stopped, to resume from on restart.
+  std::signal(SIGTERM,request_stop);
+  const double walltime = get_val(0.,conf,"walltime");
+  const json ckpt_conf =
+    out_conf.is_object() && out_conf.contains("checkpoint")
+    ? out_conf["checkpoint"] : json();
+  const bool checkpoints = !(ckpt_conf.is_null() || ckpt_conf == false);
+  const double ckpt_interval = ckpt_conf.is_number()
+    ? ckpt_conf.get<double>() : get_val(0.,ckpt_conf,"interval");
+  const std::string ckpt_name = get_val(out_base+".ckpt",ckpt_conf,"file");
+
+  std::atomic<bool> checkpoint_due = false;
+  std::jthread timer; // sets stop_requested and checkpoint_due when due
+  if (walltime > 0 || ckpt_interval > 0) timer = std::jthread(
+    [&,walltime,ckpt_interval](std::stop_token stop){
+      using clock = std::chrono::steady_clock;
+      const auto start = clock::now();
+      auto at = [&](double sec){
+        return start + std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(sec));
+      };
+      const auto deadline =
+        walltime > 0 ? at(walltime) : clock::time_point::max();
+      double next = ckpt_interval > 0 ? ckpt_interval : -1;
+      std::mutex m;
+      std::condition_variable_any cv;
+      std::unique_lock lock(m);
+      for (;;) {
+        cv.wait_until(lock, stop,
+          next > 0 ? std::min(at(next),deadline) : deadline,
+          []{ return false; });
+        if (stop.stop_requested()) return;
+        const auto now = clock::now();
+        if (now >= deadline) {
+          stop_requested = true;
+          return;
+        }
+        if (next > 0 && now >= at(next)) {
+          checkpoint_due = true;
+          next += ckpt_interval;
+        }
+      }
+    });
+
+  // Input files, and ranges of entries selected in them
+  std::vector<std::string> input_files;
+  std::vector<std::tuple<unsigned,Long64_t,Long64_t>> file_ranges;
+  std::optional<work_queue> queue; // if ranges are claimed from a queue
+  if (argc>2) {
+    input_files.assign(argv+2,argv+argc);
+  } else if (get(conf,"input").contains("queue")) {
+    const auto& q = get(conf,"input","queue");
+    queue.emplace(
+      get_str(q,"db").c_str(), get_str(q,"group"), get_val(600.,q,"lease"));
+    cout << "Work queue worker: " << queue->name() << endl;
+    if (checkpoints) throw std::runtime_error(
+      "checkpoints are not supported with a work queue");
+    input_files = queue->files();
+  } else {
+    for (const auto& file : get(conf,"input","files")) {
+      if (file.is_array()) { // [ file, first, last ]
+        file_ranges.emplace_back(input_files.size(), file.at(1), file.at(2));
+        input_files.push_back(get_str(file,0));
+      } else {
+        input_files.push_back(get_str(file));
+      }
+    }
+  }
+  if (input_files.empty()) {
+    cerr << "No input files\n";
+    return 1;
+  }
+
   // Chain input files
   TChain chain([&]{
     try {
@@ -253,9 +591,7 @@ int main(int argc, char* argv[]) {
       // get TTree name from ntuple
       // error if more than 1 TTree in file
       cout << "Tree name is not specified\n";
-      TFile file(argc>2
-        ? argv[2]
-        : get_str(conf,"input","files",0).c_str());
+      TFile file(input_files.front().c_str());
       const char* tree_name = nullptr;
       for (TObject* obj : *file.GetListOfKeys()) { // find TTree
         TKey* key = static_cast<TKey*>(obj);
@@ -277,21 +613,11 @@ int main(int argc, char* argv[]) {
     }
   }());
   cout << "Tree name: " << chain.GetName() << endl;
-  { // chain input ntuples
-    auto add = [&](const char* name){
-      cout << name << endl;
-      if (!chain.Add(name,0)) {
-        cerr << "Failed to add file to TChain\n";
-        return true;
-      }
-      return false;
-    };
-    if (argc>2) {
-      for (int i=2; i<argc; ++i)
-        if (add(argv[i])) return 1;
-    } else {
-      for (const auto& file : get(conf,"input","files"))
-        if (add(get_str(file).c_str())) return 1;
+  for (const auto& name : input_files) { // chain input ntuples
+    cout << name << endl;
+    if (!chain.Add(name.c_str(),0)) {
+      cerr << "Failed to add file to TChain\n";
+      return 1;
     }
   }
   cout << endl;
@@ -341,19 +667,72 @@ int main(int argc, char* argv[]) {
     cout << name << '\n';
   cout << endl;
 
+  // Select weights and tags for histograms -------------------------
+  const auto tags = [&]{
+    std::vector<std::tuple<std::regex,hist_tags>> defs;
+    auto make_tags = [&](const json& def) {
+      hist_tags sel;
+      const unsigned nw = multiweight::tags.size();
+      sel.weight_pos.assign(nw,-1);
+      std::vector<std::regex> ws;
+      if (def.contains("weights")) {
+        const auto& w = def["weights"];
+        if (w.is_string()) ws.push_back(w.get<std::regex>());
+        else w.get_to(ws);
+      }
+      for (unsigned i=0; i<nw; ++i) {
+        const auto& name = multiweight::tags[i];
+        if (ws.empty() || std::any_of(ws.begin(),ws.end(),
+          [&](const auto& r){ return std::regex_match(name,r); })
+        ) {
+          sel.weight_pos[i] = sel.weights.size();
+          sel.weights.push_back(i);
+        }
+      }
+      if (sel.weights.empty()) throw std::runtime_error(
+        "histogram tags selection matches no weights");
+      sel.initial_state = get_val(true,def,"initial_state");
+      sel.photon_cuts = get_val(true,def,"photon_cuts");
+      return sel;
+    };
+    if (conf.contains("tags"))
+      for (const auto& def : conf["tags"])
+        defs.emplace_back(def.at(0).get<std::regex>(),make_tags(def.at(1)));
+    defs.emplace_back(std::regex(".*"),make_tags(json::object()));
+    return [defs = std::move(defs)](const char* name) -> const hist_tags& {
+      std::cmatch m;
+      for (const auto& [r,t] : defs)
+        if (std::regex_match(name,m,r))
+          return t;
+      throw std::logic_error("no default tags selection");
+    };
+  }();
+
   // Define axes ----------------------------------------------------
-  const auto axes = [axes = [&]()
-    -> std::vector<std::tuple<std::regex,axes_t>>
-  {
-    auto& defs = get(conf,"binning");
-    if (defs.is_string())
-      return read_json(get_str(defs).c_str());
-    else
-      return defs;
-  }()](const char* name) -> auto& {
+  // and make a histogram with them and its tags and storage
+  const auto make_hist = [&tags, axes = [&]{
+    const auto& conf_defs = get(conf,"binning");
+    const json defs = conf_defs.is_string()
+      ? read_json(get_str(conf_defs).c_str())
+      : conf_defs;
+    std::vector<std::tuple<std::regex,axes_t,bool>> axes;
+    axes.reserve(defs.size());
+    for (const auto& def : defs) {
+      bool sparse = false;
+      if (def.size() > 2) {
+        if (def[2] == "sparse") sparse = true;
+        else if (def[2] != "dense") throw std::runtime_error(
+          "bins storage must be \"sparse\" or \"dense\"");
+      }
+      axes.emplace_back(
+        def.at(0).get<std::regex>(), def.at(1).get<axes_t>(), sparse );
+    }
+    return axes;
+  }()](const char* name) -> hist_t {
     std::cmatch m;
-    for (const auto& [r,a] : axes)
-      if (std::regex_match(name,m,r)) return a;
+    for (const auto& [r,a,sparse] : axes)
+      if (std::regex_match(name,m,r))
+        return hist_t(a,tags(name),sparse);
     throw std::runtime_error(cat("no axes defined for ",name));
   };
 
@@ -361,13 +740,13 @@ int main(int argc, char* argv[]) {
   std::vector<std::tuple<const char*,hist_t&>> hists;
 
   const axes_t Njets_axes = {{ ivanp::hist::uniform_axis(-0.5,4.5,5) }};
-  hist_t h_Njets_excl(Njets_axes);
+  hist_t h_Njets_excl(Njets_axes,tags("Njets_excl"));
   hists.emplace_back("Njets_excl",h_Njets_excl);
-  hist_t h_Njets_incl(Njets_axes);
+  hist_t h_Njets_incl(Njets_axes,tags("Njets_incl"));
   hists.emplace_back("Njets_incl",h_Njets_incl);
 
 #define h_(NAME) \
-  hist_t h_##NAME(axes(STR(NAME))); \
+  hist_t h_##NAME = make_hist(STR(NAME)); \
   hists.emplace_back(STR(NAME),h_##NAME);
 
   // Histograms of main observables #################################
@@ -421,33 +800,212 @@ int main(int argc, char* argv[]) {
       std::swap(entries_range[0],entries_range[1]);
     if (entries_range[1] > Nentries)
       entries_range[1] = Nentries;
-    if (entries_range != decltype(entries_range){ 0, Nentries }) {
-      Nentries = entries_range[1] - entries_range[0];
-      reader.SetEntriesRange(entries_range[0],entries_range[1]);
-    }
     cout << "Range of entries: "
       << entries_range[0] << " - " << entries_range[1] << endl;
   } catch (...) { }
 
+  // Ranges of entries in the chain.
+  // Ranges selected in files are moved to events' boundaries,
+  // so that jobs processing adjacent ranges don't share events.
+  std::vector<std::array<long unsigned,2>> segments;
+  const Long64_t* offsets = chain.GetTreeOffset();
+  auto file_range = [&](unsigned i, Long64_t first, Long64_t last)
+  -> std::array<long unsigned,2> {
+    TFile file(input_files[i].c_str());
+    TTree* tree = file.Get<TTree>(chain.GetName());
+    if (!tree) throw std::runtime_error(cat(
+      "no TTree \"",chain.GetName(),"\" in ",file.GetName()));
+    first = event_boundary(tree,first);
+    last  = event_boundary(tree,last);
+    cout << file.GetName() << ": entries " << first << " - " << last << endl;
+    return { (long unsigned)(offsets[i]+first),
+             (long unsigned)(offsets[i]+std::max(first,last)) };
+  };
+  if (!queue) {
+    std::vector<std::array<long unsigned,2>> ranges;
+    for (int i=0, n=chain.GetNtrees(); i<n; ++i)
+      ranges.push_back({ (long unsigned)offsets[i],
+        (long unsigned)(i+1<n ? offsets[i+1] : chain.GetEntries()) });
+    for (auto [i,first,last] : file_ranges)
+      ranges[i] = file_range(i,first,last);
+    Nentries = 0;
+    for (auto [first,last] : ranges) {
+      first = std::max(first,entries_range[0]);
+      last  = std::min(last ,entries_range[1]);
+      if (first >= last) continue;
+      Nentries += last - first;
+      if (!segments.empty() && segments.back()[1] == first)
+        segments.back()[1] = last;
+      else
+        segments.push_back({ first, last });
+    }
+  } else Nentries = 0; // grows as ranges are claimed
+
+  // Entry indices written by make_index, to skip entries with fewer than
+  // njets_min jets without reading them. Used if "index" is set in "input",
+  // to true for indices next to the ntuples, or to their directory.
+  std::deque<entry_index::file> index_files;
+  std::vector<const uint64_t*> index; // bitmap for every input file
+  if (const json index_conf = get_val(json(),conf,"input","index");
+      njets_min > 0 && (index_conf.is_string() || index_conf == true)
+  ) {
+    const std::string dir = index_conf.is_string() ? index_conf : "";
+    const std::string key =
+      entry_index::jets_key(jet_def.description(),jet_pt_cut,jet_eta_cut);
+    index.resize(input_files.size());
+    for (int i=0, n=chain.GetNtrees(); i<n; ++i) {
+      const auto name = entry_index::path(input_files[i],dir,key);
+      if (!std::filesystem::exists(name)) {
+        cerr << "No entry index " << name << endl;
+        continue;
+      }
+      const auto& f = index_files.emplace_back(name.c_str());
+      if (f.entries() != uint64_t(
+            (i+1<n ? offsets[i+1] : chain.GetEntries()) - offsets[i]) ||
+          f.header().at("tree") != chain.GetName()
+      ) throw std::runtime_error(cat(
+        "entry index ",name," does not match ",input_files[i]));
+      index[i] = f.bitmap(njets_min);
+      if (index[i]) cout << "Entry index: " << name << endl;
+    }
+  }
+
+  // Read the next entry, moving to the next range of entries when needed.
+  // In the queue mode, ranges are claimed one at a time.
+  auto segment = segments.begin();
+  bool in_range = false;
+  auto read_next = [&](auto& cnt){
+    PROF_SCOPE("read")
+    while (!(in_range && reader.Next())) {
+      if (queue) {
+        if (stop_requested) return false; // finish claimed ranges only
+        const auto item = queue->claim();
+        if (!item) return false;
+        const unsigned i = std::find(
+          input_files.begin(), input_files.end(), item->file
+        ) - input_files.begin();
+        if (i == input_files.size()) throw std::runtime_error(cat(
+          "file added to the queue after the start: ",item->file));
+        const auto range = file_range(i,item->first,item->last);
+        if (range[0] == range[1]) continue;
+        segments.push_back(range);
+        segment = segments.end()-1;
+        Nentries += range[1] - range[0];
+        cnt.set_end(Nentries);
+      } else if (in_range) {
+        ++segment;
+      }
+      if (segment == segments.end()) return false;
+      reader.SetEntriesRange((*segment)[0],(*segment)[1]);
+      in_range = true;
+    }
+    stats.entry(chain.GetTreeNumber());
+    return true;
+  };
+
   // event containers
   std::vector<fastjet::PseudoJet> partons;
   Higgs2diphoton higgs_decay(
     get_val(Higgs2diphoton::seed_type(0),conf,"photons","higgs_decay_seed"));
   vec4 higgs; // Higgs boson
   std::array<vec4,2> photons;
+  long unsigned Nskipped = 0; // entries skipped by the entry index
+
+  // Drop the first n entries from the ranges
+  auto skip_entries = [&](long unsigned n){
+    auto ranges = segments;
+    auto it = ranges.begin();
+    for (; it != ranges.end(); ++it) {
+      const auto len = (*it)[1] - (*it)[0];
+      if (n < len) {
+        (*it)[0] += n;
+        break;
+      }
+      n -= len;
+    }
+    ranges.erase(ranges.begin(),it);
+    return ranges;
+  };
+
+  // Checkpoints are only resumed with the same config and input
+  const std::string conf_hash = [&]{
+    ivanp::hasher h;
+    h.add(conf.dump());
+    for (const auto& file : input_files) h.add(file);
+    return h.str();
+  }();
+  // Written at an event boundary, before the next event is counted
+  auto save_checkpoint = [&](long unsigned entries){
+    for (auto& [name,h] : hists)
+      h.finalize();
+    write_checkpoint(ckpt_name, hists, {
+      { "conf", conf_hash },
+      { "entries", entries },
+      { "count", Ncount },
+      { "events", Nevents },
+      { "rng", higgs_decay.state() }
+    });
+    cout << "\nCheckpoint: " << ckpt_name
+      << " after " << entries << " entries" << endl;
+  };
+
+  long unsigned Ndone = 0; // entries processed before the checkpoint
+  if (checkpoints && std::filesystem::exists(ckpt_name)) {
+    const json state = read_checkpoint(ckpt_name,hists);
+    if (state.at("conf") != conf_hash) throw std::runtime_error(cat(
+      "checkpoint ",ckpt_name," was written with a different config"));
+    state.at("entries").get_to(Ndone);
+    state.at("count").get_to(Ncount);
+    state.at("events").get_to(Nevents);
+    higgs_decay.state(state.at("rng").get<std::string>());
+    segments = skip_entries(Ndone);
+    segment = segments.begin();
+    cout << "Resuming from " << ckpt_name
+      << " after " << Ndone << " entries" << endl;
+  }
+  bool stopped = false; // before the end of the selected entries
+
+  stats.resize(input_files.size());
+  stats.stage("setup");
 
   // EVENT LOOP =====================================================
-  for (ivanp::tcnt cnt(entries_range[0],entries_range[1]); cnt; ++cnt) {
-    reader.Next(); // read entry
+  for (ivanp::tcnt cnt(Nentries - Ndone,
+         get_val(std::string(),out_conf,"status"),
+         []{ return double(TFile::GetFileBytesRead()); });
+       read_next(cnt); ++cnt
+  ) {
+    PROF_STAGES(stage,"event") // time the stages of the loop
     const bool new_id = [id=*b_id]{ // check if event id changed
       return (event_id != id) ? ((event_id = id),true) : false;
     }();
+    if (new_id && *cnt && (stop_requested || checkpoint_due)) [[unlikely]] {
+      if (stop_requested && !queue) {
+        stopped = true;
+        Nentries = Ndone + *cnt;
+        break;
+      }
+      if (checkpoint_due) {
+        checkpoint_due = false;
+        save_checkpoint(Ndone + *cnt);
+      }
+    }
     if (new_id) {
       Ncount += (b_ncount ? **b_ncount : 1);
       ++Nevents;
     }
+    if (!index.empty()) { // skip entries rejected by the entry index
+      const int i = chain.GetTreeNumber();
+      if (index[i] && !entry_index::test(index[i],
+            reader.GetCurrentEntry() - offsets[i])) {
+        // keep the decays of the following entries as without skipping
+        if (new_id) higgs_decay.draw();
+        ++Nskipped;
+        continue;
+      }
+    }
 
     // read 4-momenta -----------------------------------------------
+    PROF_STAGE(stage,"event/particles")
     partons.clear();
     bool got_higgs = false;
     unsigned nphotons = 0;
@@ -455,14 +1013,16 @@ int main(int argc, char* argv[]) {
       const auto kf = b_kf[i];
       if (kf == 25) { // Higgs boson
         if (got_higgs) {
-          cerr << "Entry " << *cnt << " contains more than 1 Higgs boson\n";
+          cerr << "Entry " << reader.GetCurrentEntry()
+            << " contains more than 1 Higgs boson\n";
           return 1;
         }
         higgs = { b_px[i],b_py[i],b_pz[i],b_E[i] };
         got_higgs = true;
       } else if (kf == 22) { // photon
         if (nphotons > 1) {
-          cerr << "Entry " << *cnt << " contains more than 2 photons\n";
+          cerr << "Entry " << reader.GetCurrentEntry()
+            << " contains more than 2 photons\n";
           return 1;
         }
         photons[nphotons] = { b_px[i],b_py[i],b_pz[i],b_E[i] };
@@ -472,16 +1032,19 @@ int main(int argc, char* argv[]) {
         // partons.back().set_user_index(i);
       }
       if ((got_higgs + (nphotons>0)) > 1) {
-        cerr << "Entry " << *cnt << " contains unexpected particles\n";
+        cerr << "Entry " << reader.GetCurrentEntry()
+          << " contains unexpected particles\n";
         return 1;
       }
     }
     if (!(got_higgs || (nphotons==2))) {
-      cerr << "Entry " << *cnt << " is missing expected particles\n";
+      cerr << "Entry " << reader.GetCurrentEntry()
+        << " is missing expected particles\n";
       return 1;
     }
 
     // set weights --------------------------------------------------
+    PROF_STAGE(stage,"event/weights")
     { auto w = weights.begin();
       *w = *b_weight2;
       for (auto& rew : reweighters) {
@@ -495,6 +1058,7 @@ int main(int argc, char* argv[]) {
     initial_state::set(*b_id1,*b_id2);
 
     // H → γγ and photon cuts ---------------------------------------
+    PROF_STAGE(stage,"event/photons")
     if (got_higgs) {
       // reuse the same kinematics if entry is part of the same event
       photons = higgs_decay(higgs,new_id);
@@ -517,6 +1081,7 @@ int main(int argc, char* argv[]) {
     ));
 
     // Jets ---------------------------------------------------------
+    PROF_STAGE(stage,"event/jets")
     std::vector<vec4> jets = fastjet::ClusterSequence(partons,jet_def)
       .inclusive_jets() // get clustered jets
       | [](const auto& j){ return vec4(j); }; // convert to vec4
@@ -530,6 +1095,8 @@ int main(int argc, char* argv[]) {
       [](const auto& a, const auto& b){ return ( a.pt() > b.pt() ); });
     const unsigned njets = jets.size(); // number of clustered jets
 
+    // Fill histograms ----------------------------------------------
+    PROF_STAGE(stage,"event/fill")
     // Fill Njets histograms
     h_Njets_excl(njets);
     for (auto nj=njets; ; --nj) {
@@ -557,97 +1124,208 @@ int main(int argc, char* argv[]) {
     // ##############################################################
   } // end event loop
   cout << endl;
+  stats.set_file(-1);
+  stats.stage("event_loop");
 
   // finalize bins
   for (auto& [name,h] : hists)
-    for (auto& bin : h)
-      bin.finalize();
+    h.finalize();
+
+  // unprocessed entries, as "files" of the input config of a follow-up job
+  json remaining = json::array();
+  if (stopped) {
+    if (checkpoints) save_checkpoint(Nentries);
+    for (auto [first,last] : skip_entries(Nentries - Ndone)) {
+      for (int i=0, n=chain.GetNtrees(); i<n; ++i) {
+        const long unsigned a = offsets[i],
+          b = i+1<n ? offsets[i+1] : chain.GetEntries();
+        if (first < b && a < last) remaining.push_back({
+          input_files[i], std::max(first,a)-a, std::min(last,b)-a });
+      }
+    }
+    cout << "Stopped after " << Nentries << " entries\n"
+      "Remaining: " << remaining << endl;
+  }
+
+  if (queue && !queue->owns_all()) {
+    cerr << "Leases on claimed entries were lost; output is not written\n";
+    return 1;
+  }
+  // mark the claimed entries done after the output is written
+  auto finish_queue = [&](const std::string& out_name){
+    if (!queue || queue->finish()) return true;
+    cerr << "Leases on claimed entries were lost; output is removed\n";
+    std::remove(out_name.c_str());
+    return false;
+  };
+
+  const bool with_envelopes = get_val(false,out_conf,"envelopes");
+
+  // summary of the job's throughput, loaded by run/collect_jobs.py
+  // written to the output's name with .json extension, unless set otherwise
+  auto write_summary = [&]{
+    stats.stage("output");
+    std::string name = out_base + ".json";
+    if (out_conf.contains("summary")) {
+      const auto& s = out_conf["summary"];
+      if (s.is_boolean()) { if (!s) return; }
+      else name = get_str(s);
+    }
+
+    json j = stats.json();
+    j["output"] = out_name;
+    if (queue) j["worker"] = queue->name();
+    j["count"] = Ncount;
+    j["events"] = Nevents;
+    j["entries"] = Nentries;
+    j["entries_per_second"] = (Nentries - Ndone) / j["wall"].get<double>();
+    if (!index.empty()) j["skipped"] = Nskipped;
+    j["complete"] = !stopped;
+    if (stopped) j["remaining"] = remaining;
+    auto& files = j["files"] = json::array();
+    for (unsigned i=0; i<input_files.size(); ++i) {
+      const auto& f = stats.per_file()[i];
+      if (f.entries) files.push_back({
+        { "file", input_files[i] },
+        { "entries", f.entries },
+        { "wall", f.wall }
+      });
+    }
+    j["jets"] = conf.contains("jets") ? conf["jets"] : json();
+    j["reweighting"] =
+      conf.contains("reweighting") ? conf["reweighting"] : json();
+
+    std::ofstream f(name);
+    f << j.dump(2) << '\n';
+    if (!f) cerr << "Failed to write summary " << name << endl;
+    else cout << "Summary: " << name << endl;
+  };
+
+  // exit status 3 marks partial output of a stopped job
+  auto finish = [&]{
+    write_summary();
+    if (checkpoints && !stopped) std::remove(ckpt_name.c_str());
+    return stopped ? 3 : 0;
+  };
+
+  if (get_val(std::string("root"),out_conf,"format") == "native") {
+    if (with_envelopes) throw std::runtime_error(
+      "envelopes are not supported in native output format");
+    write_native(out_name.c_str(), hists,
+      { double(Ncount), double(Ncount), double(Nevents), double(Nentries) });
+    if (!finish_queue(out_name)) return 1;
+    cout << "Output: " << out_name << endl;
+    return finish();
+  }
 
   // open output ROOT file
-  TFile fout(get_str(conf,"output").c_str(),"recreate");
-  fout.SetCompressionAlgorithm(ROOT::kLZMA);
-  fout.SetCompressionLevel(9);
-
-  // convert histograms to TH1D
-  ivanp::Ycombinator([&](auto f, TDirectory* dir, auto&& get){
-    using type = std::remove_cvref_t<
-      decltype(get(std::declval<const bin_t&>())) >;
-    if constexpr (!std::is_same_v<type,basic_bin_t>) {
-      const unsigned n = type::tags.size();
-      for (unsigned i=0; i<n; ++i)
-        f(
-          dir->mkdir(ivanp::cstr(type::tags[i])),
-          [i,&get](const auto& bin) -> const auto& { return get(bin)[i]; }
-        );
-    } else {
-      dir->cd();
+  const bool compact =
+    get_val(std::string("dirs"),out_conf,"layout") == "compact";
+  TFile fout(out_name.c_str(),"recreate");
+  ivanp::set_compression(fout,
+    get_val(std::string("zstd:5"),out_conf,"compression"));
+
+  // objects are compressed and written on a separate thread,
+  // while the next ones are being filled
+  TH1::AddDirectory(false);
+  ivanp::background_writer write(fout);
+
+  if (with_envelopes) {
+    write_envelopes(write, hists, compact,
+      get_val(false,out_conf,"keep_variations"));
+  } else if (compact) {
+    // one TH2D per histogram slice, with a y bin for every combination
+    // of weight and tags carried by the histogram
+    for (const auto& [name,hist] : hists) hist.visit([&](const auto& h){
+      const auto empty = empty_cell(h,hist.sel());
+      std::vector<std::vector<unsigned>> paths;
+      std::vector<std::string> labels;
+      tag_paths(empty,paths,labels);
+      const unsigned ny = paths.size();
       double *w, *w2;
-      for (const auto& [name,h] : hists) {
-        const auto& axes = h.axes();
-        const unsigned ndim = axes.size(), ndim1 = ndim ? ndim-1 : 0;
-        struct indices {
-          unsigned
-             i = 0, // bin index in the axes
-            ni = 0, // number of bins in current axis
-             a = 0, // axis index in this dimension
-            na = 0; // number of axes in this dimension
-        };
-        std::vector<indices> ii(ndim);
-        for (unsigned d=ndim; d--; )
-          ii[d].na = axes[d].size();
-        std::vector<std::string> bins_names(ndim1);
-
-        for (auto bin_it = h.bins().begin();;) { // bin loop
-          for (unsigned d=ndim1; ; ) { // label bins
-            if (d!=0 && ii[d].i==0) {
-              auto& [i,ni,a,na] = ii[--d];
-              bins_names[d] = bin_str(axes[d][a],i);
-            } else break;
+      unsigned nx2, ix;
+      TH2D* h2 = nullptr;
+      loop_slices(name, h,
+        [&](const char* name, const axis_t& axis){ // new TH2D
+          if (h2) write({},h2);
+          h2 = std::visit([&](const auto& ax){
+            return make_root_hist(name,ax,ny);
+          },*axis);
+          TAxis* ya = h2->GetYaxis();
+          for (unsigned j=0; j<ny; ++j)
+            ya->SetBinLabel(j+1,labels[j].c_str());
+          h2->Sumw2(true);
+          w  = h2->GetArray();
+          w2 = h2->GetSumw2()->GetArray();
+          nx2 = axis.nbins();
+          ix = 0;
+        },
+        [&](const auto& b){ // fill a column of TH2D bins
+          const auto* filled = b.get_if();
+          const auto& bin = filled ? *filled : empty;
+          for (unsigned j=0; j<ny; ++j) {
+            const auto& leaf = find_leaf(bin,paths[j].data());
+            const unsigned k = ix + nx2*(j+1);
+            w [k] = leaf.w;
+            w2[k] = leaf.w2;
           }
-          for (unsigned d=ndim; d--; ) { // increment indices
-            auto& [i,ni,a,na] = ii[d];
-            if (i==0) {
-              const auto& axis = axes[d][a];
-              ni = axis.nbins();
-              if (d==ndim1) {
-                size_t len = strlen(name);
-                for (const auto& s : bins_names)
-                  len += s.size();
-                std::string name2;
-                name2.reserve(len);
-                name2 += name;
-                for (const auto& s : bins_names)
-                  name2 += s;
-
-                TH1D* h = std::visit([&](const auto& ax){
-                  return make_root_hist(name2.c_str(),ax);
-                },*axis);
-                h->Sumw2(true);
-                w  = h->GetArray();
-                w2 = h->GetSumw2()->GetArray();
-              }
+          ++ix;
+        }
+      );
+      if (h2) write({},h2);
+    });
+    write({},new TNamed("layout","compact"));
+  } else { // convert histograms to TH1D, in a directory per tag
+    ivanp::Ycombinator([&](auto f, const std::string& dir, auto&& get){
+      using type = std::remove_cvref_t<
+        decltype(*get(std::declval<const tags_t<>&>())) >;
+      if constexpr (!std::is_same_v<type,basic_bin_t>) {
+        const unsigned n = type::tags.size();
+        for (unsigned i=0; i<n; ++i) {
+          std::string sub =
+            dir.empty() ? cat(type::tags[i]) : cat(dir,'/',type::tags[i]);
+          write.mkdir(sub); // also for tags without histograms
+          f(
+            std::move(sub),
+            [i,&get](const auto& bin) -> const auto* {
+              const auto* b = get(bin);
+              return b ? b->find(i) : nullptr;
             }
-            if ((++i)>=ni) { // carry over
-              i = 0;
-              if (d) { // next axis
-                if (a+1 < na) ++a;
-              } else goto end_bin_loop;
-            } else break;
-          }
-
-          const auto& bin = get(*bin_it++);
-          *w ++ = bin.w;
-          *w2++ = bin.w2;
+          );
         }
-end_bin_loop: ;
+      } else {
+        for (const auto& [name,hist] : hists) hist.visit([&](const auto& h){
+          // skip histograms that don't carry this weight or tag
+          const auto empty = empty_cell(h,hist.sel());
+          if (!get(empty)) return;
+          double *w, *w2;
+          TH1D* h1 = nullptr;
+          loop_slices(name, h,
+            [&](const char* name, const axis_t& axis){ // new TH1D
+              if (h1) write(dir,h1);
+              h1 = std::visit([&](const auto& ax){
+                return make_root_hist(name,ax);
+              },*axis);
+              h1->Sumw2(true);
+              w  = h1->GetArray();
+              w2 = h1->GetSumw2()->GetArray();
+            },
+            [&](const auto& b){ // fill TH1D bin
+              const auto* filled = b.get_if();
+              const auto& bin = *get(filled ? *filled : empty);
+              *w ++ = bin.w;
+              *w2++ = bin.w2;
+            }
+          );
+          if (h1) write(dir,h1);
+        });
       }
-    }
-  })(
-    &fout,
-    [](const auto& bin) -> const auto& { return bin; }
-  );
+    })(
+      std::string{},
+      [](const auto& bin) -> const auto* { return &bin; }
+    );
+  }
 
-  fout.cd();
   { TH1D* N = new TH1D("N","",4,0,4);
     TAxis* a = N->GetXaxis();
     a->SetBinLabel(1,"scale");
@@ -658,10 +1336,15 @@ end_bin_loop: ;
     N->SetBinContent(2,Ncount);
     N->SetBinContent(3,Nevents);
     N->SetBinContent(4,Nentries);
+    write({},N);
   }
-  save_tags();
+  write({},new TNamed("tags",tags_json().c_str()));
 
-  // write output ROOT file
+  // finish writing output ROOT file
+  write.join();
   fout.Write(0,TObject::kOverwrite);
-  cout << "Output: " << fout.GetName() << endl;
+  fout.Close();
+  if (!finish_queue(out_name)) return 1;
+  cout << "Output: " << out_name << endl;
+  return finish();
 }
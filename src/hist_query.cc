@@ -0,0 +1,97 @@
+// Run an SQL query on a database written by root2sql,
+// with the histogram functions from hist_sql.hh available.
+// Rows are printed as JSON arrays, one per line, preceded by column names.
+// Bins BLOBs are printed as [ weights, squared weights ].
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "ivanp/sqlite.hh"
+#include "hist_sql.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+void print_usage(const char* prog) {
+  cout << "usage: " << prog << " [options ...] input.db query\n"
+    "  -h, --help   display this help text and exit\n"
+    "example:\n"
+    "  " << prog << " hists.db \"SELECT var, hist_sum(bins)"
+    " FROM hist GROUP BY var\"\n";
+}
+
+void print_value(ivanp::sqlite::stmt& stmt, int i) {
+  switch (stmt.column_type(i)) {
+    case SQLITE_INTEGER:
+      cout << stmt.column_int64(i);
+      break;
+    case SQLITE_FLOAT:
+      cout << stmt.column_double(i);
+      break;
+    case SQLITE_TEXT:
+      cout << std::quoted(stmt.column_text(i));
+      break;
+    case SQLITE_BLOB: {
+      const int n = stmt.column_bytes(i) / sizeof(double);
+      const char* p = static_cast<const char*>(stmt.column_blob(i));
+      for (int j=0; j<n; ++j) {
+        double x;
+        memcpy(&x,p+j*sizeof(double),sizeof(double));
+        cout << (j ? (j==n/2 ? "],[" : ",") : "[[") << x;
+      }
+      cout << (n ? "]]" : "null");
+    }; break;
+    case SQLITE_NULL:
+      cout << "null";
+      break;
+  }
+}
+
+int main(int argc, char* argv[]) try {
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  for (int o; (o = getopt(argc,argv,"h")) != -1; ) { // short options
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      default : return 1;
+    }
+  }
+  if (argc-optind != 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  ivanp::sqlite db(argv[optind]);
+  db.mmap_size(sqlite3_int64(1)<<30); // read the BLOBs without copying
+  hist_sql::add_functions(db);
+
+  auto stmt = db.prepare(argv[optind+1]);
+  const int ncol = stmt.column_count();
+  cout.precision(17);
+  cout << '[';
+  for (int i=0; i<ncol; ++i)
+    cout << (i ? "," : "") << std::quoted(stmt.column_name(i));
+  cout << "]\n";
+  while (stmt.step()) {
+    cout << '[';
+    for (int i=0; i<ncol; ++i) {
+      if (i) cout << ',';
+      print_value(stmt,i);
+    }
+    cout << "]\n";
+  }
+} catch (const std::exception& e) {
+  cerr << e.what() << endl;
+  return 1;
+}
@@ -0,0 +1,153 @@
+// Precompute entry indices of ntuples: bitmaps of entries with at least
+// k jets, for the jet definition and cuts of a runcard.
+// hist uses them to skip entries rejected by njets_min, reading only their
+// id and ncount.
+// See entry_index.hh for the format.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+
+#include <fastjet/ClusterSequence.hh>
+
+#include <nlohmann/json.hpp>
+
+#include "ivanp/string.hh"
+#include "ivanp/branch_reader.hh"
+#include "ivanp/tcnt.hh"
+#include "ivanp/vec4.hh"
+#include "json/fastjet.hh"
+#include "entry_index.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using nlohmann::json;
+using ivanp::cat;
+using ivanp::vec4;
+using ivanp::branch_reader;
+
+unsigned opt_k = 4;
+const char* opt_o = "";
+const char* opt_t = "t3";
+
+void print_usage(const char* prog) {
+  cout << "usage: " << prog << " [options ...] runcard.json ntuple.root ...\n"
+    "  -k N         index njets >= 1 ... N (default 4)\n"
+    "  -o dir       write the indices to dir instead of next to the ntuples\n"
+    "  -t tree      name of the TTree (default t3)\n"
+    "  -h, --help   print this message\n"
+    "The jet definition and cuts are taken from \"jets\" in the runcard.\n";
+}
+
+int main(int argc, char* argv[]) {
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  for (int o; (o = getopt(argc,argv,"hk:o:t:")) != -1; ) {
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      case 'k': opt_k = atoi(optarg); break;
+      case 'o': opt_o = optarg; break;
+      case 't': opt_t = optarg; break;
+      default : return 1;
+    }
+  }
+  if (argc-optind < 2 || opt_k < 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // same jet definition and cuts as in hist
+  const json jets_conf = [&]{
+    std::ifstream f(argv[optind]);
+    if (!f) throw std::runtime_error(cat("cannot open ",argv[optind]));
+    return json::parse(f).at("jets");
+  }();
+  const fastjet::JetDefinition jet_def = jets_conf.at("algorithm");
+  const double
+    jet_pt_cut  = jets_conf.value("/cuts/pt"_json_pointer,30.),
+    jet_eta_cut = jets_conf.value("/cuts/eta"_json_pointer,4.4);
+  const std::string key =
+    entry_index::jets_key(jet_def.description(),jet_pt_cut,jet_eta_cut);
+  fastjet::ClusterSequence::print_banner(); // get it out of the way
+  cout << jet_def.description() << "\n"
+    "jet cuts: pT > " << jet_pt_cut << ", |eta| < " << jet_eta_cut << "\n"
+    "key: " << key << '\n' << endl;
+
+  std::vector<fastjet::PseudoJet> partons;
+  std::vector<uint64_t> data;
+
+  for (int a=optind+1; a<argc; ++a) {
+    TFile file(argv[a]);
+    if (file.IsZombie()) return 1;
+    TTree* tree = file.Get<TTree>(opt_t);
+    if (!tree) {
+      cerr << "no TTree \"" << opt_t << "\" in " << argv[a] << endl;
+      return 1;
+    }
+    const uint64_t nentries = tree->GetEntries();
+    const uint64_t words = (nentries+63)/64;
+    data.assign(words*opt_k,0);
+
+    TTreeReader reader(tree);
+    branch_reader<int> b_nparticle(reader,"nparticle");
+    branch_reader<double[],float[]>
+      b_px(reader,"px"),
+      b_py(reader,"py"),
+      b_pz(reader,"pz"),
+      b_E (reader,"E" );
+    branch_reader<int[]> b_kf(reader,"kf");
+
+    cout << argv[a] << endl;
+    for (ivanp::tcnt cnt(nentries); reader.Next(); ++cnt) {
+      partons.clear();
+      for (unsigned i=0, np = *b_nparticle; i<np; ++i) {
+        const auto kf = b_kf[i];
+        if (kf == 25 || kf == 22) continue; // Higgs boson or photon
+        partons.emplace_back(b_px[i],b_py[i],b_pz[i],b_E[i]);
+      }
+      unsigned njets = 0;
+      for (const auto& j :
+        fastjet::ClusterSequence(partons,jet_def).inclusive_jets()
+      ) {
+        const vec4 jet(j); // cuts computed exactly as in hist
+        if ((jet.pt() < jet_pt_cut)
+          or (std::abs(jet.eta()) > jet_eta_cut)) continue;
+        ++njets;
+      }
+      for (unsigned k=1; k<=njets && k<=opt_k; ++k)
+        entry_index::set(data.data()+(k-1)*words, *cnt);
+    }
+
+    std::vector<unsigned> njets(opt_k);
+    for (unsigned k=0; k<opt_k; ++k) njets[k] = k+1;
+    const std::string name = entry_index::path(argv[a],opt_o,key);
+    entry_index::write(name, {
+      { "tree", opt_t },
+      { "entries", nentries },
+      { "jets", {
+        { "description", jet_def.description() },
+        { "cuts", { { "pt", jet_pt_cut }, { "eta", jet_eta_cut } } },
+        { "key", key }
+      }},
+      { "njets", njets },
+      { "size", data.size() }
+    }, data.data(), data.size());
+    cout << "Index: " << name << '\n' << endl;
+  }
+}
@@ -1,22 +1,40 @@
 #include <iostream>
 #include <stdexcept>
+#include <array>
+#include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <mutex>
 
 #include <unistd.h>
 
 #include <TFile.h>
 #include <TKey.h>
 #include <TH1.h>
+#include <TH2.h>
+#include <TROOT.h>
+
+#include <nlohmann/json.hpp>
 
 #include "ivanp/string.hh"
+#include "ivanp/ycombinator.hh"
+#include "ivanp/root_output.hh"
+#include "ivanp/hash.hh"
+#include "envelopes.hh"
 
 using std::cout;
 using std::cerr;
 using std::endl;
 using ivanp::cat;
+using envelopes::bins;
 
 std::map<const char*,TClass*,ivanp::chars_less> classes;
+std::mutex classes_mx;
 TClass* get_class(const char* name) {
+  std::lock_guard lock(classes_mx);
   auto it = classes.find(name);
   if (it != classes.end()) return it->second;
   TClass* const class_ptr = TClass::GetClass(name,true,true);
@@ -33,62 +51,220 @@ template <typename T>
 T* read_key(TObject* key) {
   return static_cast<T*>(static_cast<TKey*>(key)->ReadObj());
 }
-template <typename T>
-T get_obj(TDirectory* dir, const char* name) {
-  if constexpr (std::is_pointer_v<T>)
-    return dynamic_cast<T>(dir->Get(name));
-  else
-    return dynamic_cast<T&>(*dir->Get(name));
+
+// Structure of the output file, taken from the first input file.
+// Histograms and directories are looked up by their paths,
+// so that names don't have to be searched for in every input directory.
+struct dir_t {
+  unsigned parent;
+  std::string name, path;
+};
+struct hist_t {
+  unsigned dir;
+  std::string name;
+};
+std::vector<dir_t> dirs { { 0, { }, { } } }; // top directory first
+std::vector<hist_t> hists;
+std::unordered_map<std::string,std::pair<bool,unsigned>> paths; // is dir, i
+
+std::string join_path(const std::string& dir, const char* name) {
+  return dir.empty() ? std::string(name) : cat(dir,'/',name);
 }
 
-void loop_add(TDirectory* out, TDirectory* in, bool first) {
+void scan(TDirectory* in, unsigned d) {
   for (TObject* key : *in->GetListOfKeys()) {
     const char* const name = key->GetName();
     const char* const class_name = static_cast<TKey*>(key)->GetClassName();
     TClass* const class_ptr = get_class(class_name);
+    std::string path = join_path(dirs[d].path,name);
     if (inherits_from<TDirectory>(class_ptr)) {
-      loop_add(
-        first ? out->mkdir(name) : &get_obj<TDirectory&>(out,name),
-        read_key<TDirectory>(key),
-        first
-      );
+      const unsigned i = dirs.size();
+      if (!paths.try_emplace(path,true,i).second) continue;
+      dirs.push_back({ d, name, std::move(path) });
+      scan(read_key<TDirectory>(key),i);
     } else if (inherits_from<TH1>(class_ptr)) {
-      TH1* h = read_key<TH1>(key);
-      if (first) {
-        out->cd();
-        h->Clone();
-      } else {
-        get_obj<TH1&>(out,name).Add(h);
-      }
+      if (!paths.try_emplace(std::move(path),false,hists.size()).second)
+        continue;
+      hists.push_back({ d, name });
     }
   }
 }
 
-template <bool first=true>
-void loop_xsec(TDirectory* dir, double factor) {
-  for (TObject* obj : *dir->GetList()) {
-    TClass* const class_ptr = get_class(obj->ClassName());
-    if (inherits_from<TDirectory>(class_ptr)) {
-      loop_xsec<false>( static_cast<TDirectory*>(obj), factor );
-    } else if (inherits_from<TH1>(class_ptr)) {
-      if constexpr (first)
-        if (!strcmp(obj->GetName(),"N")) continue;
-      static_cast<TH1*>(obj)->Scale(factor,"width");
+// Partial sum of histograms, indexed the same way as hists
+using partial_t = std::vector<std::unique_ptr<TH1>>;
+
+void add(TH1* h, std::unique_ptr<TH1>& sum) {
+  if (sum) {
+    sum->Add(h);
+    delete h;
+  } else sum.reset(h);
+}
+
+void loop_add(partial_t& out, TDirectory* in, const std::string& dir) {
+  for (TObject* key : *in->GetListOfKeys()) {
+    const char* const name = key->GetName();
+    const std::string path = join_path(dir,name);
+    const auto it = paths.find(path);
+    if (it == paths.end()) {
+      const char* const class_name = static_cast<TKey*>(key)->GetClassName();
+      TClass* const class_ptr = get_class(class_name);
+      if (
+        inherits_from<TDirectory>(class_ptr) ||
+        inherits_from<TH1>(class_ptr)
+      ) throw std::runtime_error(cat(
+        path," in ",in->GetFile()->GetName(),
+        " is not in the first input file"));
+      continue;
+    }
+    const auto [is_dir,i] = it->second;
+    if (is_dir) loop_add(out,read_key<TDirectory>(key),path);
+    else add(read_key<TH1>(key),out[i]);
+  }
+}
+
+// Manifest of the merged input files, with their content hashes and
+// normalization counters. Allows to add new inputs to an existing output
+// with -u.
+struct input_t {
+  std::string file, hash, stamp; // hash is only computed with -u
+  std::vector<double> N;
+};
+
+std::vector<input_t> read_manifest(const char* str, double& scale) {
+  const auto j = nlohmann::json::parse(str);
+  scale = j.value("scale",0.);
+  std::vector<input_t> inputs;
+  for (const auto& in : j.at("inputs"))
+    inputs.push_back({ in.at("file"), in.value("hash",""),
+      in.value("stamp",""), in.at("N") });
+  return inputs;
+}
+std::string write_manifest(const std::vector<input_t>& inputs, double scale) {
+  nlohmann::json j;
+  if (scale != 0) j["scale"] = scale;
+  auto& js = j["inputs"] = nlohmann::json::array();
+  for (const auto& in : inputs)
+    js.push_back({
+      { "file", in.file }, { "hash", in.hash }, { "stamp", in.stamp },
+      { "N", in.N }
+    });
+  return j.dump();
+}
+
+// Undo Scale(1./scale,"width")
+void unscale(TH1* h, double scale) {
+  const int dim = h->GetDimension();
+  const TAxis *ax = h->GetXaxis(), *ay = h->GetYaxis(), *az = h->GetZaxis();
+  for (int iz=0, nz=(dim>2 ? h->GetNbinsZ()+2 : 1); iz<nz; ++iz)
+  for (int iy=0, ny=(dim>1 ? h->GetNbinsY()+2 : 1); iy<ny; ++iy)
+  for (int ix=0, nx=h->GetNbinsX()+2; ix<nx; ++ix) {
+    double f = scale * ax->GetBinWidth(ix);
+    if (dim>1) f *= ay->GetBinWidth(iy);
+    if (dim>2) f *= az->GetBinWidth(iz);
+    const int bin = h->GetBin(ix,iy,iz);
+    h->SetBinContent(bin,h->GetBinContent(bin)*f);
+    h->SetBinError(bin,h->GetBinError(bin)*f);
+  }
+}
+
+// Envelopes ---------------------------------------------------------
+// Output histograms, with paths of their directories
+using out_hists_t = std::vector<std::pair<std::string,TH1*>>;
+
+// Compact layout: columns of every TH2 are replaced
+out_hists_t compact_envelopes(out_hists_t in, bool keep_vars) {
+  std::map<std::vector<std::string>,envelopes::column_envelopes> plans;
+  for (auto& [path,h] : in) {
+    TH2* h2 = dynamic_cast<TH2*>(h);
+    if (!h2) continue;
+    const auto labels = envelopes::column_labels(h2);
+    const auto& plan =
+      plans.try_emplace(labels,labels,keep_vars).first->second;
+    TH2D* out = envelopes::compact_envelopes(h2,plan);
+    delete h;
+    h = out;
+  }
+  return in;
+}
+
+// Directories layout: top level directories named by weights are replaced
+out_hists_t dirs_envelopes(out_hists_t in, bool keep_vars) {
+  out_hists_t out;
+  // histograms with the same path below the weight directories
+  std::vector<std::string> keys;
+  std::map<std::string,std::vector<std::pair<std::string,TH1*>>> groups;
+  for (auto& [path,h] : in) {
+    const auto slash = path.find('/');
+    if (path.empty()) { // not in a weight directory
+      out.emplace_back(path,h);
+      continue;
     }
+    std::string rel = slash==path.npos ? "" : path.substr(slash);
+    auto key = cat(rel,'/',h->GetName());
+    auto& group = groups[key];
+    if (group.empty()) keys.push_back(std::move(key));
+    group.emplace_back(path.substr(0,slash),h);
   }
+
+  std::map<std::vector<std::string>,envelopes::column_envelopes> plans;
+  for (const auto& key : keys) {
+    const auto& group = groups[key];
+    const std::string rel = key.substr(0,key.rfind('/'));
+    std::vector<std::string> labels;
+    std::vector<const double*> ins;
+    for (const auto& [label,h] : group) {
+      labels.push_back(label);
+      ins.push_back(bins(h));
+    }
+    const auto& plan =
+      plans.try_emplace(labels,labels,keep_vars).first->second;
+    const auto& out_labels = plan.labels();
+    std::vector<bool> used(group.size());
+    std::vector<double*> cols;
+    std::vector<TH1*> hs;
+    for (unsigned k=0; k<out_labels.size(); ++k) {
+      TH1* h;
+      if (const int j = plan.source(k); j >= 0 && !used[j]) {
+        h = group[j].second;
+        used[j] = true;
+      } else { // stat. unc. only for copied histograms
+        h = static_cast<TH1*>(group[0].second->Clone());
+        h->Sumw2(false);
+      }
+      hs.push_back(h);
+      cols.push_back(bins(h));
+    }
+    plan(ins.data(),cols.data(),group[0].second->GetNcells());
+    for (unsigned k=0; k<hs.size(); ++k)
+      out.emplace_back(out_labels[k]+rel,hs[k]);
+    for (unsigned j=0; j<group.size(); ++j)
+      if (!used[j]) delete group[j].second;
+  }
+  return out;
 }
 
 bool opt_x = false;
+bool opt_u = false;
+bool opt_e = false;
+bool opt_v = false;
+const char* opt_c = "lzma:9";
+unsigned opt_j = 1;
 #define TOGGLE(x) x = !x
 
 void print_usage(const char* prog) {
   cout << "usage: " << prog << " [options ...] output.root input1.root [...]\n"
     "  -x           convert weight to cross section\n"
     "               and divide by bin width\n"
+    "  -c alg[:lvl] output compression, e.g. zstd:5 for intermediate files\n"
+    "               none, zlib, lz4, zstd, or lzma (default lzma:9)\n"
+    "  -j N         number of threads reading and adding input files\n"
+    "  -u           update existing output, only adding new input files\n"
+    "  -e           replace scale and PDF variations with envelopes\n"
+    "  -v           with -e, also keep the variations\n"
     "  -h, --help   display this help text and exit\n";
 }
 
-int main(int argc, char* argv[]) {
+int main(int argc, char* argv[]) try {
   if (argc < 2) {
     print_usage(argv[0]);
     return 1;
@@ -102,63 +278,279 @@ int main(int argc, char* argv[]) {
       }
     }
   }
-  for (int o; (o = getopt(argc,argv,"hx")) != -1; ) { // short options
+  for (int o; (o = getopt(argc,argv,"hxuevc:j:")) != -1; ) { // short options
     switch (o) {
       case 'h': print_usage(argv[0]); return 0;
       case 'x': TOGGLE(opt_x); break;
+      case 'u': TOGGLE(opt_u); break;
+      case 'e': TOGGLE(opt_e); break;
+      case 'v': TOGGLE(opt_v); break;
+      case 'c': opt_c = optarg; break;
+      case 'j': opt_j = std::max(atoi(optarg),1); break;
       default : return 1;
     }
   }
+  if (argc-optind < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
 
-  cout << "output: " << argv[optind] << endl;
-  TFile fout(argv[optind],"recreate"); // open output file
-  if (fout.IsZombie()) return 1;
-  fout.SetCompressionAlgorithm(ROOT::kLZMA);
-  fout.SetCompressionLevel(9);
-  ++optind;
-
-  TObject* tags1 { };
-  for (int i=optind; i<argc; ++i) { // loop over input files
-    const bool first = (i==optind);
-    cout << "input: " << argv[i] << endl;
-    TFile fin(argv[i]);
+  TH1::AddDirectory(false);
+
+  const char* const out_name = argv[optind++];
+  cout << "output: " << out_name << endl;
+
+  char** const inputs = argv+optind;
+  const unsigned ninputs = argc-optind;
+  for (unsigned i=0; i<ninputs; ++i)
+    cout << "input: " << inputs[i] << endl;
+
+  // tags and output layout must be the same in all input files
+  constexpr std::array<const char*,2> meta_names { "tags", "layout" };
+
+  // manifest of the inputs, saved in the output
+  std::vector<input_t> manifest(ninputs);
+  for (unsigned i=0; i<ninputs; ++i) {
+    manifest[i].file = inputs[i];
+    try {
+      manifest[i].stamp = ivanp::file_stamp(inputs[i]);
+    } catch (...) { } // reported when the file is opened by ROOT
+  }
+
+  // with -u, add to the histograms already in the output file
+  partial_t old;
+  std::vector<std::string> old_meta;
+  std::vector<unsigned> added; // indices of inputs to read
+  for (unsigned i=0; i<ninputs; ++i) added.push_back(i);
+  if (opt_u && !access(out_name,F_OK)) {
+    TFile fin(out_name);
     if (fin.IsZombie()) return 1;
+    std::vector<input_t> old_manifest;
+    double old_scale = 0;
+    if (const TObject* m = fin.Get("manifest"))
+      old_manifest = read_manifest(m->GetTitle(),old_scale);
 
-    TObject* tags = fin.Get("tags");
-    if (first && tags) {
-      // cout << tags->GetTitle() << endl;
-      tags1 = tags->Clone();
-    } else if (
-      ( (!tags) != (!tags1) ) ||
-      ( tags && strcmp(tags->GetTitle(),tags1->GetTitle()) )
-    ) {
-      cerr << "differing sets of histogram tags\n";
-      return 1;
+    // only add inputs that aren't already in the output
+    // a changed or removed input requires a full rebuild,
+    // because its old content is no longer available to subtract
+    std::map<std::string_view,const input_t*> in_old;
+    for (const auto& in : old_manifest) in_old.emplace(in.file,&in);
+
+    // only hash the contents of inputs with changed sizes or times
+    std::vector<unsigned> to_hash;
+    for (unsigned i=0; i<ninputs; ++i) {
+      auto& in = manifest[i];
+      const auto it = in_old.find(in.file);
+      if (it != in_old.end() && !in.stamp.empty()
+          && it->second->stamp == in.stamp)
+        in.hash = it->second->hash;
+      else to_hash.push_back(i);
+    }
+    { const unsigned n = to_hash.size();
+      const unsigned nthreads = std::min(opt_j,n);
+      std::vector<std::jthread> threads;
+      for (unsigned t=0; t<nthreads; ++t)
+        threads.emplace_back([&,t]{
+          for (unsigned i=t; i<n; i+=nthreads) {
+            auto& in = manifest[to_hash[i]];
+            try {
+              in.hash = ivanp::file_hash(in.file.c_str());
+            } catch (...) { } // reported when the file is opened by ROOT
+          }
+        });
+    }
+
+    bool rebuild = old_manifest.empty() || (old_scale!=0) != opt_x;
+    added.clear();
+    for (unsigned i=0; i<ninputs && !rebuild; ++i) {
+      const auto it = in_old.find(manifest[i].file);
+      if (it == in_old.end()) added.push_back(i);
+      else if (it->second->hash != manifest[i].hash) rebuild = true;
+      else {
+        manifest[i].N = it->second->N;
+        in_old.erase(it);
+      }
+    }
+    if (!in_old.empty()) rebuild = true;
+
+    if (rebuild) {
+      cout << "inputs changed, merging all" << endl;
+      added.resize(ninputs);
+      for (unsigned i=0; i<ninputs; ++i) added[i] = i;
+    } else if (added.empty()) {
+      cout << "output is up to date" << endl;
+      return 0;
+    } else {
+      cout << "adding " << added.size() << " new inputs" << endl;
+      for (const char* name : meta_names) {
+        const TObject* meta = fin.Get(name);
+        old_meta.emplace_back(meta ? meta->GetTitle() : "");
+      }
+      scan(&fin,0);
+      old.resize(hists.size());
+      loop_add(old,&fin,{});
+      if (old_scale != 0) { // undo cross section scaling
+        const auto N = paths.find("N");
+        TH1* hN = N!=paths.end() ? old[N->second.second].get() : nullptr;
+        for (auto& h : old)
+          if (h && h.get()!=hN) unscale(h.get(),old_scale);
+        if (hN) hN->SetBinContent(1,old_scale);
+      }
+    }
+  }
+  // merge the new inputs, and add the old sum at the end
+  std::vector<char*> to_read;
+  for (unsigned i : added) to_read.push_back(inputs[i]);
+
+  std::array<TObject*,meta_names.size()> meta1 { };
+  { TFile fin(to_read[0]);
+    if (fin.IsZombie()) return 1;
+    for (unsigned m=0; m<meta_names.size(); ++m) {
+      TObject* meta = fin.Get(meta_names[m]);
+      if (meta) meta1[m] = meta->Clone();
+      if (!old_meta.empty() && old_meta[m] != (meta ? meta->GetTitle() : "")) {
+        cerr << "differing " << meta_names[m] << " in input files\n";
+        return 1;
+      }
+    }
+    if (old.empty()) scan(&fin,0);
+  }
+
+  // each thread adds a contiguous range of the input files
+  const unsigned nread = to_read.size();
+  const unsigned nthreads = std::min<unsigned>(opt_j,nread);
+  if (nthreads > 1) ROOT::EnableThreadSafety();
+  std::vector<partial_t> partials(nthreads);
+  std::vector<std::string> errors(nthreads);
+  auto add_range = [&](unsigned t){
+    partial_t& partial = partials[t];
+    partial.resize(hists.size());
+    try {
+      for (
+        unsigned i = nread*t/nthreads, end = nread*(t+1)/nthreads;
+        i < end; ++i
+      ) {
+        TFile fin(to_read[i]);
+        if (fin.IsZombie()) throw std::runtime_error(cat(
+          "cannot open ",to_read[i]));
+        for (unsigned m=0; m<meta_names.size(); ++m) {
+          TObject* meta = fin.Get(meta_names[m]);
+          if (
+            ( (!meta) != (!meta1[m]) ) ||
+            ( meta && strcmp(meta->GetTitle(),meta1[m]->GetTitle()) )
+          ) throw std::runtime_error(cat(
+            "differing ",meta_names[m]," in input files"));
+        }
+        if (const TH1* N = dynamic_cast<const TH1*>(fin.Get("N"))) {
+          auto& n = manifest[added[i]].N;
+          for (int b=1, nb=N->GetNbinsX(); b<=nb; ++b)
+            n.push_back(N->GetBinContent(b));
+        }
+        loop_add(partial,&fin,{});
+      }
+    } catch (const std::exception& e) {
+      errors[t] = e.what();
     }
+  };
+
+  // add partial sums pairwise, in a tree reduction
+  auto reduce = [&](partial_t& a, partial_t& b){
+    for (unsigned i=0, n=hists.size(); i<n; ++i)
+      if (auto& h = b[i]) add(h.release(),a[i]);
+  };
 
-    loop_add(&fout,&fin,first);
+  if (nthreads > 1) {
+    { std::vector<std::jthread> threads;
+      for (unsigned t=0; t<nthreads; ++t)
+        threads.emplace_back(add_range,t);
+    }
+    for (const auto& e : errors)
+      if (!e.empty()) {
+        cerr << e << endl;
+        return 1;
+      }
+    for (unsigned step=1; step<nthreads; step*=2) {
+      std::vector<std::jthread> threads;
+      for (unsigned a=0; a+step<nthreads; a+=2*step)
+        threads.emplace_back(reduce,
+          std::ref(partials[a]), std::ref(partials[a+step]));
+    }
+  } else {
+    add_range(0);
+    if (!errors[0].empty()) {
+      cerr << errors[0] << endl;
+      return 1;
+    }
   }
+  partial_t& sum = partials[0];
+  if (!old.empty()) reduce(sum,old);
 
+  double scale = 0;
   if (opt_x) { // convert weight to cross section and divide by bin width
-    TH1* N = get_obj<TH1*>(&fout,"N");
+    const auto it = paths.find("N");
+    TH1* N = it!=paths.end() && !it->second.first
+      ? sum[it->second.second].get() : nullptr;
     if (N) {
-      const double
-        scale = N->GetBinContent(1),
-        count = N->GetBinContent(2);
+      const double count = N->GetBinContent(2);
+      scale = N->GetBinContent(1);
       if (scale==count) {
         cout << "scaling to cross section, 1/" << scale << endl;
-        loop_xsec(&fout,1./scale);
+        for (auto& h : sum)
+          if (h && h.get()!=N) h->Scale(1./scale,"width");
         N->SetBinContent(1,1);
       } else {
         cerr << "input histograms appear to have already been scaled" << endl;
+        scale = 0;
       }
     } else {
       cerr << "cannot scale to cross section without \"N\" histogram" << endl;
     }
   }
 
+  TFile fout(out_name,"recreate"); // open output file
+  if (fout.IsZombie()) return 1;
+  ivanp::set_compression(fout,opt_c);
+
+  out_hists_t out;
+  for (unsigned i=0; i<hists.size(); ++i)
+    if (TH1* h = sum[i].release())
+      out.emplace_back(dirs[hists[i].dir].path,h);
+
+  if (opt_e) { // replace variations with envelopes
+    const bool compact = meta1[1] && !strcmp(meta1[1]->GetTitle(),"compact");
+    out = compact
+      ? compact_envelopes(std::move(out),opt_v)
+      : dirs_envelopes(std::move(out),opt_v);
+  }
+
+  // recreate directories and attach histograms to them
+  std::map<std::string,TDirectory*> out_dirs { { "", &fout } };
+  auto get_dir = [&](const std::string& path){
+    return ivanp::Ycombinator([&](auto get_dir, const std::string& path)
+    -> TDirectory* {
+      auto [it,inserted] = out_dirs.try_emplace(path);
+      if (inserted) {
+        const auto slash = path.rfind('/');
+        TDirectory* parent = slash==path.npos
+          ? &fout : get_dir(path.substr(0,slash));
+        it->second = parent->mkdir(path.c_str()+(slash+1));
+      }
+      return it->second;
+    })(path);
+  };
+  if (!opt_e) // keep the order, and empty directories
+    for (unsigned i=1; i<dirs.size(); ++i) get_dir(dirs[i].path);
+  for (auto& [path,h] : out)
+    h->SetDirectory(get_dir(path));
+
   fout.cd();
-  if (tags1) tags1->Write();
+  for (TObject* meta : meta1)
+    if (meta) meta->Write();
+  if (!opt_e) // variations are needed to add more inputs
+    TNamed("manifest",write_manifest(manifest,scale).c_str()).Write();
 
   fout.Write(0,TObject::kOverwrite);
+} catch (const std::exception& e) {
+  cerr << e.what() << endl;
+  return 1;
 }
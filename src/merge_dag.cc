@@ -0,0 +1,278 @@
+// Merge a whole production of histogram files:
+// runs of the same process part into a part file (with cross section scaling),
+// and B, RS, I, V parts into an NLO file.
+// Merging jobs are executed concurrently, as soon as their inputs are ready.
+// Outputs are skipped if the content of their inputs hasn't changed since
+// they were last merged, as recorded in a .hash file next to each output.
+// Inputs with the same sizes and modification times as recorded there
+// are not hashed again.
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <map>
+#include <regex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "ivanp/string.hh"
+#include "ivanp/hash.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using ivanp::cat;
+namespace fs = std::filesystem;
+
+extern char** environ;
+
+// Merge graph -------------------------------------------------------
+struct node {
+  fs::path out;
+  std::vector<fs::path> inputs;
+  std::vector<std::string> opts; // merge options
+  std::vector<unsigned> dependents;
+  unsigned npending = 0; // unfinished dependencies
+  bool failed = false;
+  bool merged = false; // merged, or would be with -n
+  bool inputs_merged = false; // some dependency merged
+};
+
+std::vector<node> nodes;
+fs::path merge_exe;
+bool opt_n = false;
+
+bool run(node& n) {
+  const auto& out = n.out.native();
+  if (n.failed) {
+    cerr << "skipping " << out << ": an input failed to merge" << endl;
+    return false;
+  }
+
+  // the .hash file holds the content hash of the inputs,
+  // followed by the stamp of their sizes and modification times
+  fs::path hash_file = n.out;
+  hash_file += ".hash";
+  std::string old_hash, old_stamp;
+  if (fs::exists(n.out))
+    std::ifstream(hash_file) >> old_hash >> old_stamp;
+
+  auto merging = [&]{
+    cout << "merging: " << out << endl;
+    n.merged = true;
+  };
+  // with -n, merged inputs may not exist yet
+  if (opt_n && n.inputs_merged) {
+    merging();
+    return true;
+  }
+
+  ivanp::hasher hs;
+  for (const auto& opt : n.opts) hs.add(opt);
+  for (const auto& in : n.inputs) {
+    hs.add(in.native());
+    hs.add_stamp(in.c_str());
+  }
+  const std::string stamp = hs.str();
+  if (!old_hash.empty() && old_stamp == stamp) {
+    cout << "up to date: " << out << endl;
+    return true;
+  }
+
+  ivanp::hasher h;
+  for (const auto& opt : n.opts) h.add(opt);
+  for (const auto& in : n.inputs) {
+    h.add(in.native());
+    h.add_file(in.c_str());
+  }
+  const std::string hash = h.str();
+
+  if (!old_hash.empty() && old_hash == hash) {
+    cout << "up to date: " << out << endl;
+    if (!opt_n) std::ofstream(hash_file) << hash << '\n' << stamp << '\n';
+    return true;
+  }
+
+  merging();
+  if (opt_n) return true;
+  fs::create_directories(n.out.parent_path());
+  fs::remove(hash_file);
+
+  std::vector<std::string> args { merge_exe.native() };
+  args.insert(args.end(),n.opts.begin(),n.opts.end());
+  args.push_back(out);
+  for (const auto& in : n.inputs)
+    args.push_back(in.native());
+  std::vector<char*> argv;
+  for (auto& arg : args) argv.push_back(arg.data());
+  argv.push_back(nullptr);
+
+  pid_t pid;
+  if (posix_spawn(&pid,argv[0],nullptr,nullptr,argv.data(),environ)) {
+    cerr << "cannot run " << argv[0] << endl;
+    return false;
+  }
+  int status;
+  while (waitpid(pid,&status,0) < 0)
+    if (errno != EINTR) return false;
+  if (!(WIFEXITED(status) && WEXITSTATUS(status)==0)) {
+    cerr << "failed to merge " << out << endl;
+    return false;
+  }
+
+  std::ofstream(hash_file) << hash << '\n' << stamp << '\n';
+  return true;
+}
+
+void print_usage(const char* prog) {
+  cout << "usage: " << prog << " [options ...] out_dir merged_dir\n"
+    "  -j N         number of concurrent merging jobs\n"
+    "  -n           only print what would be merged\n"
+    "  -h, --help   display this help text and exit\n";
+}
+
+int main(int argc, char* argv[]) {
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  unsigned opt_j = std::max(std::thread::hardware_concurrency(),1u);
+  for (int o; (o = getopt(argc,argv,"hj:n")) != -1; ) { // short options
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      case 'j': opt_j = std::max(atoi(optarg),1); break;
+      case 'n': opt_n = true; break;
+      default : return 1;
+    }
+  }
+  if (argc-optind != 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  const fs::path out_dir(argv[optind]), merged_dir(argv[optind+1]);
+  if (!fs::is_directory(out_dir)) {
+    cerr << '\"' << out_dir.native() << "\" is not a directory" << endl;
+    return 1;
+  }
+
+  merge_exe = fs::read_symlink("/proc/self/exe").parent_path() / "merge";
+  if (access(merge_exe.c_str(),X_OK)) {
+    cerr << "cannot find " << merge_exe.native() << endl;
+    return 1;
+  }
+
+  // runs -> parts, e.g. out/H2jB_ED_1.root -> merged/H2jB_ED.root
+  std::map<fs::path,unsigned> outputs;
+  { const std::regex run_re("_[0-9]+\\.root$");
+    std::map<fs::path,std::vector<fs::path>> runs;
+    for (const auto& f : fs::recursive_directory_iterator(out_dir)) {
+      if (!f.is_regular_file()) continue;
+      const auto rel = fs::relative(f.path(),out_dir).native();
+      std::smatch m;
+      if (!std::regex_search(rel,m,run_re)) continue;
+      runs[(merged_dir / cat(m.prefix().str(),".root")).lexically_normal()]
+        .push_back(f.path());
+    }
+    for (auto& [out,inputs] : runs) {
+      std::sort(inputs.begin(),inputs.end());
+      outputs.emplace(out,nodes.size());
+      nodes.push_back({ out, std::move(inputs), { "-x", "-u" } });
+    }
+  }
+
+  // parts -> NLO, e.g. merged/H2jB_ED.root -> merged/H2jNLO_ED.root
+  { const std::regex part_re("((^|/)[^_]*)(B|RS|I|V)_");
+    std::vector<fs::path> parts;
+    for (const auto& [out,i] : outputs) parts.push_back(out);
+    if (fs::is_directory(merged_dir))
+      for (const auto& f : fs::recursive_directory_iterator(merged_dir))
+        if (f.is_regular_file() && f.path().extension()==".root")
+          parts.push_back(f.path().lexically_normal());
+
+    std::map<fs::path,std::vector<fs::path>> nlos;
+    for (const auto& part : parts) {
+      const auto& s = part.native();
+      if (!std::regex_search(s,part_re)) continue;
+      nlos.try_emplace(std::regex_replace(s,part_re,"$1NLO_",
+        std::regex_constants::format_first_only));
+    }
+    const std::regex nlo_re("(.*(^|/)[^_]*)NLO(_.*)");
+    for (auto& [nlo,inputs] : nlos) {
+      std::vector<unsigned> deps;
+      for (const char* p : { "B", "RS", "I", "V" }) {
+        fs::path part =
+          std::regex_replace(nlo.native(),nlo_re,cat("$1",p,"$3"));
+        const auto it = outputs.find(part);
+        if (it != outputs.end()) deps.push_back(it->second);
+        else if (!fs::exists(part)) break; // a part is missing
+        inputs.push_back(std::move(part));
+      }
+      if (inputs.size() != 4) continue;
+      for (unsigned d : deps)
+        nodes[d].dependents.push_back(nodes.size());
+      nodes.push_back({ nlo, std::move(inputs), { } });
+      nodes.back().npending = deps.size();
+    }
+  }
+
+  // execute the graph -------------------------------------------------
+  std::deque<unsigned> ready;
+  for (unsigned i=0; i<nodes.size(); ++i)
+    if (!nodes[i].npending) ready.push_back(i);
+  unsigned remaining = nodes.size(), nfailed = 0;
+  std::mutex mx;
+  std::condition_variable cv;
+
+  auto worker = [&]{
+    std::unique_lock lock(mx);
+    for (;;) {
+      cv.wait(lock,[&]{ return !ready.empty() || !remaining; });
+      if (!remaining) return;
+      node& n = nodes[ready.front()];
+      ready.pop_front();
+      lock.unlock();
+
+      bool ok;
+      try {
+        ok = run(n);
+      } catch (const std::exception& e) {
+        cerr << e.what() << endl;
+        ok = false;
+      }
+
+      lock.lock();
+      --remaining;
+      if (!ok) ++nfailed;
+      for (unsigned d : n.dependents) {
+        auto& dep = nodes[d];
+        if (!ok) dep.failed = true;
+        if (n.merged) dep.inputs_merged = true;
+        if (!--dep.npending) ready.push_back(d);
+      }
+      cv.notify_all();
+    }
+  };
+  { std::vector<std::jthread> threads;
+    for (unsigned i=std::min<unsigned>(opt_j,nodes.size()); i--; )
+      threads.emplace_back(worker);
+  }
+
+  if (nfailed) {
+    cerr << nfailed << " of " << nodes.size() << " merges failed" << endl;
+    return 1;
+  }
+}
@@ -0,0 +1,121 @@
+// Add histograms in the native binary format, see hbin.hh
+
+#include <iostream>
+#include <vector>
+#include <memory>
+
+#include <unistd.h>
+
+#include "hbin.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+bool opt_x = false;
+#define TOGGLE(x) x = !x
+
+void print_usage(const char* prog) {
+  cout << "usage: " << prog << " [options ...] output.hbin input1.hbin [...]\n"
+    "  -x           convert weight to cross section\n"
+    "               and divide by bin width\n"
+    "  -h, --help   display this help text and exit\n";
+}
+
+// Bin widths, including underflow and overflow,
+// which are given the widths of the first and last bins, like in ROOT
+std::vector<double> bin_widths(const nlohmann::json& axis) {
+  std::vector<double> widths;
+  if (axis.contains("edges")) {
+    const auto edges = axis["edges"].get<std::vector<double>>();
+    const unsigned n = edges.size()-1;
+    widths.reserve(n+2);
+    widths.push_back(edges[1]-edges[0]);
+    for (unsigned i=0; i<n; ++i)
+      widths.push_back(edges[i+1]-edges[i]);
+    widths.push_back(widths.back());
+  } else {
+    const unsigned n = axis.at("ndiv");
+    widths.assign(n+2,
+      (axis.at("max").get<double>()-axis.at("min").get<double>())/n);
+  }
+  return widths;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  for (int o; (o = getopt(argc,argv,"hx")) != -1; ) { // short options
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      case 'x': TOGGLE(opt_x); break;
+      default : return 1;
+    }
+  }
+  if (argc-optind < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  const char* out_name = argv[optind++];
+  cout << "output: " << out_name << endl;
+
+  nlohmann::json header;
+  std::vector<double> data;
+  std::unique_ptr<hbin::file> first;
+  for (int i=optind; i<argc; ++i) { // loop over input files
+    cout << "input: " << argv[i] << endl;
+    auto fin = std::make_unique<hbin::file>(argv[i]);
+    if (!first) {
+      header = fin->header();
+      data.assign(fin->data(),fin->data()+fin->size());
+      first = std::move(fin); // keep mapped to compare headers
+    } else {
+      // binning, labels, and tags must be the same in all input files
+      if (fin->header_str() != first->header_str()) {
+        cerr << "differing headers in input files\n";
+        return 1;
+      }
+      hbin::add(data.data(),fin->data(),data.size());
+    }
+  }
+
+  if (opt_x) { // convert weight to cross section and divide by bin width
+    double* N = data.data() + header.at("N").at("offset").get<size_t>();
+    const double scale = N[0], count = N[1];
+    if (scale==count) {
+      cout << "scaling to cross section, 1/" << scale << endl;
+      const double factor = 1./scale;
+      for (const auto& h : header.at("hists")) {
+        const auto widths = bin_widths(h.at("axis"));
+        const unsigned nx = widths.size();
+        const unsigned ny = h.at("labels").size();
+        double* w  = data.data() + h.at("offset").get<size_t>();
+        double* w2 = w + ny*nx;
+        for (unsigned j=0; j<ny; ++j) {
+          for (unsigned i=0; i<nx; ++i) {
+            const double f = factor/widths[i];
+            *w ++ *= f;
+            *w2++ *= f*f;
+          }
+        }
+      }
+      N[0] = 1;
+    } else {
+      cerr << "input histograms appear to have already been scaled" << endl;
+    }
+  }
+
+  hbin::write(out_name,header,data.data(),data.size());
+}
@@ -7,6 +7,7 @@
 #include <LHAPDF/LHAPDF.h>
 
 #include "ivanp/branch_reader.hh"
+#include "ivanp/prof.hh"
 
 using ivanp::branch_reader;
 
@@ -97,6 +98,15 @@ struct reweighter_impl: event {
   std::vector<double> weights;
   std::vector<std::string> weights_names;
 
+#ifdef IVANP_PROF
+  std::vector<unsigned> prof_pdf; // per PDF member
+  std::array<unsigned,5> prof_part; // per part type: B, RS, I, V, other
+  unsigned prof_part_site() {
+    return prof_part[
+      std::min<size_t>(std::string_view("BRIV").find(part[0]),4)];
+  }
+#endif
+
   std::string make_weight_name(
     const std::string& scale, unsigned ki, unsigned pdfi
   ) {
@@ -125,6 +135,15 @@ struct reweighter_impl: event {
       weights_names.emplace_back(make_weight_name(args.scale,i,0));
     for (unsigned i=1; i<pdfs.size(); ++i) // pdf variations
       weights_names.emplace_back(make_weight_name(args.scale,0,i));
+
+#ifdef IVANP_PROF
+    for (const auto& pdf : pdfs)
+      prof_pdf.push_back(ivanp::prof::site(ivanp::cat(
+        "reweighter/pdf/",pdf->set().name(),':',
+        std::to_string(pdf->memberID()))));
+    for (unsigned i=0; const char* p : { "B", "RS", "I", "V", "other" })
+      prof_part[i++] = ivanp::prof::site(ivanp::cat("reweighter/part/",p));
+#endif
   }
 
   struct fac_calc_struct {
@@ -231,19 +250,23 @@ struct reweighter_impl: event {
   }
 
   void operator()() {
+    PROF_SCOPE_ID(prof_part_site())
     scale_base_value = scale_f(*this);
 
-    pdf = fc.pdf = pdfs[0].get();
-    for (auto& vars : ren_vars) ren_calc(vars);
-    for (auto& vars : fac_vars) fac_calc(vars);
-
-    // scale variations
     unsigned wi = 0;
-    for (; wi<args.Ki.size(); ++wi)
-      weights[wi] = combine(args.Ki[wi]);
+    { PROF_SCOPE_ID(prof_pdf[0])
+      pdf = fc.pdf = pdfs[0].get();
+      for (auto& vars : ren_vars) ren_calc(vars);
+      for (auto& vars : fac_vars) fac_calc(vars);
+
+      // scale variations
+      for (; wi<args.Ki.size(); ++wi)
+        weights[wi] = combine(args.Ki[wi]);
+    }
 
     // pdf variations
     for (unsigned i=1; i<pdfs.size(); ++i, ++wi) {
+      PROF_SCOPE_ID(prof_pdf[i])
       pdf = fc.pdf = pdfs[i].get();
       ren_calc(ren_vars[0]);
       fac_calc(fac_vars[0]);
@@ -1,10 +1,28 @@
+// Convert histograms from ROOT files to an SQLite database.
+// Every histogram is a row of the hist table, with a column for every label,
+// taken from the file name, the directories, and the histogram name.
+// Bins are stored as BLOBs of doubles: sums of weights for all bins,
+// including underflow and overflow, followed by sums of squared weights.
+// Axes are stored once in the axes table, as BLOBs of the bins' edges.
+
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <unordered_map>
+#include <optional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstring>
+
+#include <unistd.h>
 
 #include <TFile.h>
 #include <TKey.h>
 #include <TH1.h>
+#include <TROOT.h>
 
 #include "ivanp/string.hh"
 #include "ivanp/sqlite.hh"
@@ -46,18 +64,10 @@ std::vector<std::string_view> split(std::string_view s, std::string_view d) {
   return v;
 }
 
-template <typename T, typename D>
-std::string join(const T& xs, const D& d) {
-  std::stringstream ss;
-  for (size_t i=0, n=xs.size(); i<n; ++i) {
-    if (i) ss << d;
-    ss << xs[i];
-  }
-  return std::move(ss).str();
-}
-
 std::map<const char*,TClass*,ivanp::chars_less> classes;
+std::mutex classes_mx;
 TClass* get_class(const char* name) {
+  std::lock_guard lock(classes_mx);
   auto it = classes.find(name);
   if (it != classes.end()) return it->second;
   TClass* const class_ptr = TClass::GetClass(name,true,true);
@@ -75,12 +85,21 @@ T* read_key(TObject* key) {
   return static_cast<T*>(static_cast<TKey*>(key)->ReadObj());
 }
 
-std::vector<std::vector<double>> binning;
+// Packed arrays of doubles
+template <typename T>
+std::string pack(const T* xs, size_t n) {
+  return { reinterpret_cast<const char*>(xs), n*sizeof(T) };
+}
+
+struct row {
+  std::vector<std::string> labels;
+  std::string edges, bins;
+};
 
 void loop(
   TDirectory* dir,
   const std::vector<std::string_view>& labels,
-  ivanp::sqlite::stmt& stmt,
+  std::vector<row>& rows,
   bool first = true
 ) {
   for (TObject* key : *dir->GetListOfKeys()) {
@@ -90,58 +109,70 @@ void loop(
     if (inherits_from<TDirectory>(class_ptr)) {
       auto labels2 = labels;
       labels2.emplace_back(name);
-      loop( read_key<TDirectory>(key), labels2, stmt, false );
+      loop( read_key<TDirectory>(key), labels2, rows, false );
     } else if (!first && inherits_from<TH1>(class_ptr)) {
       auto labels2 = labels;
       split(name,"__",labels2);
-      for (const auto& x : labels2)
-        cout << x << ' ';
-      cout << endl;
+      row& r = rows.emplace_back();
+      r.labels.assign(labels2.begin(),labels2.end());
 
       TH1* const h = read_key<TH1>(key);
 
-      const int n = h->GetNbinsX() + 1;
-      std::vector<double> h_edges(n);
-      for (int i=0; i<n; ++i)
-        h_edges[i] = h->GetBinLowEdge(i+1);
-      int axis = -1, naxes = binning.size();
-      for (int i=0; i<naxes; ++i) {
-        if (h_edges == binning[i]) {
-          axis = i;
-          break;
-        }
-      }
-      if (axis<0) {
-        binning.emplace_back(std::move(h_edges));
-        axis = naxes;
+      const int n = h->GetNbinsX() + 2;
+      const TArrayD* xbins = h->GetXaxis()->GetXbins();
+      if (xbins->GetSize()) {
+        r.edges = pack(xbins->GetArray(),xbins->GetSize());
+      } else {
+        std::vector<double> edges(n-1);
+        for (int i=0; i<n-1; ++i)
+          edges[i] = h->GetBinLowEdge(i+1);
+        r.edges = pack(edges.data(),edges.size());
       }
 
-      std::stringstream bins;
-      char buf[32];
-      for (int i=0; i<=n; ++i) {
-        sprintf(buf,",%.6g,%.6g",h->GetBinContent(i),h->GetBinError(i));
-        bins << (i ? buf : buf+1);
-      }
+      std::vector<double> bins(n*2);
+      for (int i=0; i<n; ++i)
+        bins[i] = h->GetBinContent(i);
+      if (h->GetSumw2N())
+        std::copy_n(h->GetSumw2()->GetArray(),n,bins.data()+n);
+      else
+        std::copy_n(bins.data(),n,bins.data()+n);
+      r.bins = pack(bins.data(),bins.size());
 
-      stmt.reset().clear();
-      int v=0;
-      try {
-        for (const auto& x : labels2)
-          stmt.bind(++v,x);
-        stmt.bind(++v,axis);
-        stmt.bind(++v,std::move(bins).str());
-      } catch (const ivanp::sqlite_error& e) {
-        cerr << "\033[31m" "too few labels specified" "\033[0m\n" ;
-        throw;
-      }
-      stmt.step();
+      delete h;
     }
   }
 }
 
-int main(int argc, char* argv[]) {
+void print_usage(const char* prog) {
+  cout << "usage: " << prog
+    << " [options ...] output.db [input.root ...] [labels ...]\n"
+    "  -j N         number of threads reading input files\n"
+    "  -h, --help   display this help text and exit\n";
+}
+
+int main(int argc, char* argv[]) try {
+  for (int i=1; i<argc; ++i) { // long options
+    const char* arg = argv[i];
+    if (*(arg++)=='-' && *(arg++)=='-') {
+      if (!strcmp(arg,"help")) {
+        print_usage(argv[0]);
+        return 0;
+      }
+    }
+  }
+  unsigned opt_j = std::max(std::thread::hardware_concurrency(),1u);
+  for (int o; (o = getopt(argc,argv,"hj:")) != -1; ) { // short options
+    switch (o) {
+      case 'h': print_usage(argv[0]); return 0;
+      case 'j': opt_j = std::max(atoi(optarg),1); break;
+      default : return 1;
+    }
+  }
+  const char* const prog = argv[0];
+  argc -= optind-1;
+  argv += optind-1;
   if (argc<3) {
-    cout << "usage: " << argv[0] << " output.db [input.root ...] [labels ...]\n";
+    print_usage(prog);
     return 1;
   }
 
@@ -155,49 +186,140 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  const int nlabels = argc-arg_in_end;
+
   ivanp::sqlite db(argv[1]);
+  // a new database: nothing to lose if interrupted
+  db.synchronous("OFF").journal_mode("MEMORY");
+  ivanp::sqlite::transaction transaction(db);
 
   { std::stringstream sql;
     sql <<
-      "BEGIN;"
       "CREATE TABLE hist (\n";
     for (int i=arg_in_end; i<argc; ++i)
       sql << (i==arg_in_end ? "  " : ", ") << argv[i] << " TEXT\n";
     sql <<
       ", axis INTEGER\n"
-      ", bins TEXT\n"
+      ", bins BLOB\n"
       ");";
 
     sql << "CREATE TABLE axes (\n"
       "  id INTEGER PRIMARY KEY\n"
-      ", edges TEXT\n"
+      ", edges BLOB\n"
       ");";
 
     db(std::move(sql).str().c_str());
   }
 
-  std::string vals((argc-arg_in_end+2)*2-1,'?');
+  std::string vals((nlabels+2)*2-1,'?');
   for (size_t i=1; i<vals.size(); i+=2)
     vals[i] = ',';
-  auto stmt = db.prepare(cat("INSERT INTO hist VALUES (",vals,")").c_str());
-
-  for (int i=2; i<arg_in_end; ++i) {
-    std::string_view arg = argv[i];
-    TFile fin(arg.data());
-    if (fin.IsZombie()) {
-      cerr << "Cannot open file \"" << arg << "\"\n";
-      return 1;
+  const std::string insert_hist = cat("INSERT INTO hist VALUES (",vals,")");
+  std::unordered_map<std::string,int> axes; // packed edges -> id
+  std::vector<const std::string*> axes_edges;
+
+  // Files are read on separate threads.
+  // Rows are inserted on this thread, in the order of the input files.
+  ROOT::EnableThreadSafety();
+  TH1::AddDirectory(false);
+  const int nfiles = arg_in_end-2;
+  std::vector<std::optional<std::vector<row>>> files(nfiles);
+  int next = 0;
+  bool failed = false;
+  std::exception_ptr error; // thrown by a worker, rethrown here
+  std::mutex mx;
+  std::condition_variable cv;
+
+  auto worker = [&]{
+    for (;;) {
+      int i;
+      { std::lock_guard lock(mx);
+        if (failed || next >= nfiles) return;
+        i = next++;
+      }
+      std::string_view arg = argv[i+2];
+      std::vector<row> rows;
+      try {
+        TFile fin(arg.data());
+        if (fin.IsZombie()) throw std::runtime_error(cat(
+          "Cannot open file \"",arg,"\""));
+        arg.remove_prefix(arg.rfind('/')+1);
+        loop( &fin, split({arg.data(),arg.size()-5}, "_"), rows );
+      } catch (...) {
+        std::lock_guard lock(mx);
+        if (!error) error = std::current_exception();
+        failed = true;
+        cv.notify_all();
+        return;
+      }
+      std::lock_guard lock(mx);
+      files[i] = std::move(rows);
+      cv.notify_all();
+    }
+  };
+  std::vector<std::jthread> threads;
+  for (unsigned i=std::min<unsigned>(opt_j,nfiles); i--; )
+    threads.emplace_back(worker);
+
+  for (int i=0; i<nfiles; ++i) {
+    std::vector<row> rows;
+    { std::unique_lock lock(mx);
+      cv.wait(lock,[&]{ return failed || files[i]; });
+      if (failed) {
+        lock.unlock();
+        threads.clear();
+        if (error) std::rethrow_exception(error);
+        return 1;
+      }
+      rows = std::move(*files[i]);
+      files[i].reset();
+    }
+    for (const row& r : rows) {
+      for (const auto& x : r.labels)
+        cout << x << ' ';
+      cout << endl;
+      if ((int)r.labels.size() > nlabels) {
+        cerr << "\033[31m" "too few labels specified" "\033[0m\n" ;
+        { std::lock_guard lock(mx);
+          failed = true;
+        }
+        threads.clear();
+        return 1;
+      }
+
+      auto [axis,inserted] = axes.try_emplace(r.edges,axes.size());
+      if (inserted) axes_edges.push_back(&axis->first);
+
+      auto& stmt = db.cached(insert_hist);
+      int v=0;
+      for (const auto& x : r.labels)
+        stmt.bind(++v,x);
+      stmt.bind(nlabels+1,axis->second);
+      stmt.bind(nlabels+2,ivanp::sqlite::blob(r.bins),false);
+      stmt.step();
     }
-    arg.remove_prefix(arg.rfind('/')+1);
-    loop( &fin, split({arg.data(),arg.size()-5}, "_"), stmt );
   }
 
-  stmt = db.prepare("INSERT INTO axes VALUES (?,?)");
-  for (int i=0, n=binning.size(); i<n; ++i) {
-    stmt.reset().clear();
-    stmt.bind_all(i,join(binning[i],','));
-    stmt.step();
+  { std::vector<int> ids(axes_edges.size());
+    std::vector<ivanp::sqlite::blob> edges;
+    for (int i=0, n=ids.size(); i<n; ++i) {
+      ids[i] = i;
+      edges.emplace_back(*axes_edges[i]);
+    }
+    db.insert("INSERT INTO axes VALUES (?,?)",ids,edges);
+  }
+
+  // index the labels, so that a histogram can be found without a scan
+  { std::stringstream sql;
+    sql << "CREATE INDEX hist_labels ON hist (";
+    for (int i=arg_in_end; i<argc; ++i)
+      sql << (i==arg_in_end ? "" : ", ") << argv[i];
+    sql << ");";
+    db(std::move(sql).str().c_str());
   }
 
-  db("END;");
+  transaction.commit();
+} catch (const std::exception& e) {
+  cerr << e.what() << endl;
+  return 1;
 }